@@ -0,0 +1,85 @@
+/*
+
+Interface for running the cache memory simulator inside another program.
+Build main.c with -DCACHESIM_LIBRARY to leave out main(), e.g.
+
+    gcc -O2 -pthread -DCACHESIM_LIBRARY -c main.c -o cachesim.o
+
+then create a cache from a CacheSimConfig, run memory references through it
+one at a time with CacheSimAccess or many at a time with CacheSimAccessBatch,
+and read its counters with CacheSimGetCounters. None of these functions print
+anything except when the cache cannot be created.
+
+A tracing process can also feed a running simulator without a trace file:
+the simulator started with --ring <name> creates a shared memory ring buffer
+of references, the tracing process attaches to it with TraceRingAttach, adds
+references with TraceRingPush and calls TraceRingClose after the last one.
+There is one producer and one consumer per ring.
+*/
+#ifndef CACHESIM_H
+#define CACHESIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*struct used to describe the cache to create, zero latencies and word size take the defaults*/
+typedef struct _cachesimconfig {
+    long long MainMemorySize;//bytes, only sets the address width
+    int CacheSize;
+    int BlockSize;
+    int SetAssoc;
+    char ReplacementPolicy;//L, F, P, S, B, U or R
+    char WritePolicy;//B (write-back) or T (write-through)
+    int HitLatency;//cycles
+    int MissPenalty;//cycles
+    int WordSize;//bytes sent to memory by each write-through write
+} CacheSimConfig;
+
+/*struct used to return what the cache did so far*/
+typedef struct _cachesimcounters {
+    long long References;
+    long long Hits;
+    long long ReadHits;
+    long long ReadMisses;
+    long long WriteHits;
+    long long WriteMisses;
+    long long DirtyEvictions;
+    long long DirtyBlocks;//dirty blocks still in the cache
+    long long FillBytes;
+    long long WritebackBytes;
+    long long WriteThroughBytes;
+    double HitRate;//hits / references
+    double AverageAccessTime;//cycles
+} CacheSimCounters;
+
+/*struct used to pass memory references in batches, also the layout of a slot of the shared memory ring*/
+typedef struct _cachesimreference {
+    uint64_t Address;
+    uint32_t Write;//0 for a read, 1 for a write
+    uint32_t Core;//core that issued the reference, for --cores
+} CacheSimReference;
+
+typedef struct _cachesim CacheSim;
+typedef struct _tracering TraceRing;
+
+//returns NULL if the configuration is invalid
+CacheSim* CacheSimCreate(const CacheSimConfig *config);
+//returns 1 on a hit and 0 on a miss
+int CacheSimAccess(CacheSim *sim, uint64_t address, int write);
+//returns the number of hits among the n references
+long long CacheSimAccessBatch(CacheSim *sim, const CacheSimReference *refs, size_t n);
+void CacheSimGetCounters(CacheSim *sim, CacheSimCounters *counters);
+//clears the counters and keeps the contents of the cache
+void CacheSimResetCounters(CacheSim *sim);
+void CacheSimFree(CacheSim *sim);
+
+//attaches the tracing process to the ring a simulator created, returns NULL if there is none
+TraceRing* TraceRingAttach(const char *name);
+//adds a reference, waits while the ring is full
+void TraceRingPush(TraceRing *ring, uint64_t address, int write, int core);
+//makes the references pushed so far visible to the simulator, TraceRingPush only does so every few references
+void TraceRingFlush(TraceRing *ring);
+//tells the simulator the trace is over and detaches from the ring
+void TraceRingClose(TraceRing *ring);
+
+#endif
@@ -9,21 +9,192 @@ Using this input, the program generates the main memory table, final
 cache status, and calculates the total address lines, number of bits 
 for the offset, index, and tag, as well as total cache size, best 
 possible hit rate, and average hit rate
+
+The same parameters can also be given on the command line (run with -h
+for the list), in which case the memory references are streamed through
+the cache one at a time and only the cache state and counters are kept
+in memory, so traces of any length can be simulated.
 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include "cachesim.h"
+
+/*Everything but the CacheSim and TraceRing functions of cachesim.h is static, so a
+program linking the library object (built with -DCACHESIM_LIBRARY, which leaves out
+main) can use any names of its own. The command line functions are still compiled in
+but nothing calls them then*/
+#ifdef CACHESIM_LIBRARY
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+
+//size of each chunk read from the memory reference file
+#define TRACE_CHUNK_SIZE (1 << 20)
+//number of memory references decoded at a time
+#define TRACE_BLOCK_SIZE 4096
+//size of the buffer used for the memory table and cache status output
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+//latencies in cycles used for the average memory access time, and the bytes of one write-through write
+#define DEFAULT_HIT_LATENCY 1
+#define DEFAULT_MISS_PENALTY 100
+#define DEFAULT_WORD_SIZE 4
+//output modes: counters only, every Nth line of the table, or everything
+#define OUTPUT_SUMMARY 0
+#define OUTPUT_SAMPLED 1
+#define OUTPUT_FULL 2
+//binary result files, see WriteResultsBinary
+#define RESULT_FILE_MAGIC "CMRS"
+#define RESULT_FILE_VERSION 3
+#define RESULT_RECORD_SIZE 152
+/*binary memory reference files start with this 16 byte header (little endian):
+  bytes 0-3   magic "CMTB"
+  byte  4     format version
+  byte  5     address width in bits (32 or 64)
+  bytes 6-7   reserved, 0
+  bytes 8-15  number of memory references
+followed by one record per reference: the difference from the previous
+address zigzag encoded, shifted left by one with the R/W flag (W = 1) in
+the low bit, and written as a little endian base 128 varint. Version 2
+files come from multi-core traces and follow every record with the id of
+the core that issued it as a second varint*/
+#define BINARY_TRACE_MAGIC "CMTB"
+#define BINARY_TRACE_VERSION 1
+#define BINARY_TRACE_VERSION_CORES 2
+#define BINARY_TRACE_HEADER_SIZE 16
+//cache snapshots, see SaveSnapshot
+#define SNAPSHOT_MAGIC "CMSS"
+#define SNAPSHOT_VERSION 2//version 1 had a smaller FIFO state
+#define SNAPSHOT_HEADER_SIZE 48
+#define COUNTERS_PER_SET (sizeof(CacheCounters) / sizeof(long long))
+//classes of misses, see ClassifyMiss
+#define MISS_NONE 0
+#define MISS_COMPULSORY 1
+#define MISS_CAPACITY 2
+#define MISS_CONFLICT 3
+//table value of a block that has left the shadow cache of the miss classifier
+#define SHADOW_EVICTED INT_MAX
+//number of sets listed as conflict hotspots
+#define CONFLICT_HOTSPOTS 10
+//multi-core simulation, see SimulateMultiCore: cores are bits of a 64 bit sharer mask
+#define MAX_CORES 64
+#define PINGPONG_HOTSPOTS 10
+//each cache line is one word: the valid bit, the dirty bit, the prefetched bit and the tag in the bits below them
+#define LINE_VALID ((uint64_t)1 << 63)
+#define LINE_DIRTY ((uint64_t)1 << 62)
+#define LINE_PREFETCHED ((uint64_t)1 << 61)
+#define LINE_TAG_MASK (LINE_PREFETCHED - 1)
+//prefetchers, see RunPrefetcher
+#define PREFETCH_NONE 0
+#define PREFETCH_NEXT_LINE 1
+#define PREFETCH_STRIDE 2
+#define PREFETCH_STREAM 3
+#define DEFAULT_PREFETCH_DEGREE 1
+#define DEFAULT_PREFETCH_DISTANCE 1
+//the stride prefetcher's reference prediction table, each entry follows one region of memory
+#define RPT_INDEX_BITS 8
+#define RPT_ENTRIES (1 << RPT_INDEX_BITS)
+#define RPT_REGION_BITS 12
+//streams followed by the stream prefetcher, and how far in blocks a miss may be from one to continue it
+#define STREAM_TRACKERS 16
+#define STREAM_WINDOW 16
+//synthetic trace patterns, see NextGeneratedBlock
+#define GEN_SEQUENTIAL 0
+#define GEN_STRIDED 1
+#define GEN_UNIFORM 2
+#define GEN_ZIPF 3
+#define GEN_CHASE 4
+#define GEN_MIXED 5
+#define GEN_PATTERNS 6
+//bytes between sequential references, and the size of one zipfian or pointer chasing item
+#define GEN_WORD_SIZE 4
+#define GEN_ITEM_SIZE 64
+#define DEFAULT_GEN_REFERENCES 10000000
+#define DEFAULT_GEN_FOOTPRINT (64LL << 20)
+#define DEFAULT_GEN_WRITES 25
+#define DEFAULT_GEN_STRIDE 256
+#define DEFAULT_ZIPF_EXPONENT 0.99
+//benchmark matrix used when --bench is given without lists, see RunBenchmark
+#define BENCH_MAX_LIST 16
+//caches checked by --self-test
+#define SELF_TEST_MAX_WAYS 16
+#define SELF_TEST_REFERENCES 50000
+#define DEFAULT_BENCH_PATTERNS "seq,stride,uniform,zipf,chase,mixed"
+#define DEFAULT_BENCH_POLICIES "LPS"
+#define DEFAULT_BENCH_ASSOC "1,8,16"
+#define DEFAULT_BENCH_SIZES "32768,1048576"
+#define DEFAULT_BENCH_REPEAT 3
+//associativities 1, 2, 4, ... with a specialized simulation kernel, see SelectSimulationKernel
+#define KERNEL_WAYS 5
+//cache hierarchy: number of levels, inclusion policies and the kinds of access between levels
+#define MAX_CACHE_LEVELS 3
+#define INCLUSION_NINE 0
+#define INCLUSION_INCLUSIVE 1
+#define INCLUSION_EXCLUSIVE 2
+#define ACCESS_READ 0
+#define ACCESS_WRITE 1
+#define ACCESS_WRITEBACK 2
+#define ACCESS_VICTIM 3
+#define ACCESS_END 4
+//default hit latencies of the L2 and L3 caches in cycles
+#define DEFAULT_L2_HIT_LATENCY 10
+#define DEFAULT_L3_HIT_LATENCY 40
+//TLBs and page walks of --tlb, see TranslateAddress
+#define PAGE_TABLE_LEVELS 4
+#define PAGE_TABLE_BASE ((uint64_t)1 << 44)//16 TiB, above the addresses of most traces
+#define DEFAULT_PAGE_SHIFT 12
+#define DEFAULT_L1_TLB_ENTRIES 64
+#define DEFAULT_L1_TLB_ASSOC 4
+#define DEFAULT_L2_TLB_ENTRIES 1536
+#define DEFAULT_L2_TLB_ASSOC 12
+#define DEFAULT_L2_TLB_LATENCY 7//cycles
+#define DEFAULT_WALK_CACHE_ENTRIES 32
+#define DEFAULT_WALK_LATENCY 30//cycles per page table read that does not go through the data cache
+//z value of the 95% confidence intervals of set sampling
+#define SAMPLE_Z 1.96
+//messages in each ring buffer between pipeline stages, and how often the indexes are published
+#define RING_SIZE (1 << 14)
+#define RING_PUBLISH_BATCH 64
+//shared memory ring a tracing process fills for --ring, see OpenTraceRing
+#define TRACE_RING_MAGIC "CMRB"
+#define TRACE_RING_VERSION 1
+#define TRACE_RING_HEADER_SIZE 256
+#define DEFAULT_TRACE_RING_SLOTS (1 << 20)
+//a ring name of up to 255 characters with the leading slash added
+#define TRACE_RING_NAME_SIZE 257
+//an idle side of the ring yields this many times, then sleeps this long between checks
+#define TRACE_RING_SPINS 64
+#define TRACE_RING_SLEEP_NS 100000
 
 /*struct used to create and store the user's input*/
 typedef struct _memory {
-    int MainMemorySize;
+    long long MainMemorySize;
     int CacheSize;
     int CacheBlockSize;
     int SetAssoc;
     char ReplacementPolicy[2];
     char WritePolicy[2];
+    int HitLatency;//cycles
+    int MissPenalty;//cycles
+    int WordSize;//bytes sent to memory by each write-through write
 } Memory;
 /*struct used to store cache characteristics*/
 typedef struct _size {
@@ -41,125 +212,911 @@ typedef struct _size {
 /*struct used to store the input file data*/
 typedef struct _filecontents {
     int ReadOrWrite; 
-    int Address; 
+    uint64_t Address; 
     int NumberofMemoryReferences;
-    
+    int Core;//core that issued the reference, 0 unless the trace names cores
+
 } FileContents;
 /*struct used to create main memory table*/
 typedef struct _memorylocationtable {
-    int MainMemoryBlockNum; 
+    uint64_t MainMemoryBlockNum; 
     int CacheMemorySetNum;
     int CacheMemoryBlockNum;
-    char HitOrMiss[10];
-    int tag;
+    int Hit;
+    uint64_t tag;
+    int MissClass;//MISS_NONE unless misses are being classified
 } MemoryLocationTable;
-/*struct used to fill cache */
-typedef struct _cache {
-    char DirtyBit[2];
-    int ValidBit;
-    char tag[100];
-    char data[10];
-    int setnum;
-    int blknum;
-    char HitorMiss[10];
-} Cache;
+/*struct used to stream the memory references out of the input file
+one chunk at a time instead of loading the whole file*/
+typedef struct _tracereader {
+    FILE *fp;
+    char *buffer;
+    size_t length;
+    size_t pos;
+    int eof;
+    long long NumberofMemoryReferences;
+    long long ReferencesRead;
+    //binary files are mapped into memory and decoded in place
+    int Binary;
+    int AddressBits;
+    const unsigned char *map;//NULL when reading a buffer owned by someone else
+    size_t mapLength;
+    const unsigned char *cursor;
+    const unsigned char *end;
+    int64_t PreviousAddress;
+    int HasCores;//version 2 binary files carry a core id per reference
+    TraceRing *ring;//NULL unless the references come from a shared memory ring
+} TraceReader;
+/*struct used to count what the cache did, kept for the whole cache and for every set*/
+typedef struct _cachecounters {
+    long long ReadHits;
+    long long ReadMisses;
+    long long WriteHits;
+    long long WriteMisses;
+    long long DirtyEvictions;
+    long long WritebackBytes;
+    long long WriteThroughBytes;
+    long long FillBytes;
+} CacheCounters;
+/*struct used to describe a replacement policy, each set keeps StateBytes(ways)
+bytes of policy state that the functions below read and update*/
+typedef struct _replacementpolicy {
+    char Code;
+    const char *Name;
+    size_t (*StateBytes)(int ways);
+    void (*Init)(unsigned char *state, int ways, int set);
+    void (*Hit)(unsigned char *state, int ways, int way);
+    void (*Fill)(unsigned char *state, int ways, int way);
+    int (*Victim)(unsigned char *state, int ways);
+} ReplacementPolicy;
+/*struct used by the prefetchers, see RunPrefetcher. Prefetched lines carry
+LINE_PREFETCHED until their first demand reference, and Ready holds the cycle each
+line's prefetch completes so a demand reference that arrives earlier is counted as late*/
+typedef struct _rptentry {
+    uint64_t Region;
+    uint64_t LastBlock;
+    long long Stride;
+    int Confidence;//0 to 3, prefetches are issued from 2
+    int Valid;
+} RptEntry;
+typedef struct _streamtracker {
+    uint64_t LastBlock;
+    int Direction;//1 ascending, -1 descending, 0 not known yet
+    int Confirmations;
+    long long LastUse;
+} StreamTracker;
+typedef struct _prefetcher {
+    int Kind;
+    int Degree;
+    int Distance;
+    int HitLatency;
+    int MissPenalty;
+    uint64_t NumMemoryBlocks;
+    long long Clock;//cycles of the demand references so far
+    long long *Ready;//one per line, laid out like CacheState.lines
+    //bit filter of blocks evicted by prefetches, a demand miss on one of them is pollution
+    uint64_t *Evicted;
+    int EvictedBits;
+    RptEntry Table[RPT_ENTRIES];
+    StreamTracker Streams[STREAM_TRACKERS];
+    long long Issued;
+    long long Redundant;//already in the cache, nothing was fetched
+    long long Useful;
+    long long Late;
+    long long LateCycles;
+    long long Useless;//evicted before any demand reference
+    long long PollutionMisses;
+} Prefetcher;
+/*struct used to hold the cache contents and counters between memory references.
+Every line of the cache is one 64 bit word holding its valid, dirty and prefetched
+bits and tag (see LINE_VALID), the lines of a set are contiguous and every set starts on
+a 64 byte cache line, so a probe touches one or two cache lines of metadata*/
+typedef struct _cachestate CacheState;
+//runs a block of memory references through the cache, see SelectSimulationKernel
+typedef void (*SimulationKernel)(CacheState *state, FileContents *refs, int n);
+struct _cachestate {
+    uint64_t *lines;
+    int LineStride;//lines per set including the padding
+    int SetAssoc;
+    int WriteBack;
+    int WriteThrough;
+    const ReplacementPolicy *Policy;
+    unsigned char *ReplacementState;
+    size_t ReplacementStride;
+    int NumCacheBlocks;
+    int NumCacheSets;
+    //sets simulated by this copy of the state, all of them unless the cache is sharded
+    int FirstSet;
+    int EndSet;
+    int BlockSize;
+    int WordSize;
+    long long ActualHits;
+    long long NumberofMemoryReferences;
+    CacheCounters Counters;
+    CacheCounters *SetCounters;
+    //set sampling: which sets are sampled (NULL when all are), and whether the others are skipped
+    unsigned char *SampledSets;
+    int NumSampledSets;
+    int SampleOnly;
+    Prefetcher *Prefetch;//NULL unless a prefetcher is attached
+    //address decomposition when PowerOfTwo: block = address >> BlockShift,
+    //set = block & SetMask, tag = block >> SetShift
+    int PowerOfTwo;
+    int BlockShift;
+    int SetShift;
+    uint64_t SetMask;
+    SimulationKernel Kernel;
+};
+/*struct used to hold what set sampling estimates for the whole cache, the rates
+are per reference and each margin is the half width of its 95% confidence
+interval (-1 when it cannot be computed)*/
+typedef struct _sampleestimate {
+    int Sets;
+    int SampledSets;
+    long long TotalReferences;
+    long long SampledReferences;
+    long long Hits;//in the sampled sets
+    CacheCounters Counters;//sums over the sampled sets
+    double HitRate;
+    double HitRateMargin;
+    double EvictionRate;
+    double EvictionRateMargin;
+} SampleEstimate;
+//classifies misses as compulsory, capacity or conflict, defined with its functions
+typedef struct _missclassifier MissClassifier;
+/*struct used to describe a synthetic memory reference stream, see NextGeneratedBlock*/
+typedef struct _generatorconfig {
+    int Pattern;//GEN_SEQUENTIAL ... GEN_MIXED
+    long long References;
+    long long Footprint;//bytes of memory the addresses fall in
+    uint64_t Seed;
+    int WritePercent;
+    long long Stride;//bytes between the references of the strided pattern
+    double ZipfExponent;//between 0 and 1, higher is more skewed
+} GeneratorConfig;
+/*struct used to hold the state of one generated trace*/
+typedef struct _tracegenerator {
+    GeneratorConfig config;
+    uint64_t rng;
+    long long Remaining;
+    uint64_t Position;//next address of the sequential stream
+    uint64_t StridePosition;//next address of the strided stream
+    uint64_t Items;//GEN_ITEM_SIZE items in the footprint
+    double ZipfZetaN;
+    double ZipfAlpha;
+    double ZipfEta;
+    double ZipfHalfPow;
+    uint32_t *Chain;//next item of the pointer chase
+    uint32_t ChaseNode;
+} TraceGenerator;
+/*struct used to describe the TLBs, page size and page walks of --tlb*/
+typedef struct _tlbconfig {
+    int Enabled;
+    int PageShift;//12, 21 or 30 for 4 KiB, 2 MiB or 1 GiB pages
+    int L1Entries;
+    int L1Assoc;
+    int L2Entries;//0 for no L2 TLB
+    int L2Assoc;
+    int L2Latency;//cycles of each L2 TLB lookup
+    int WalkCacheEntries;//per page table level, 0 for no page-walk cache
+    int WalkLatency;
+    int Inject;//send the page table reads through the data cache
+} TlbConfig;
+/*struct used to hold the benchmark matrix, comma separated lists except Policies
+which is one replacement policy code per character*/
+typedef struct _benchconfig {
+    int Enabled;
+    char Patterns[128];
+    char Policies[16];
+    char Assocs[128];
+    char Sizes[256];
+    int Repeat;
+} BenchConfig;
+/*struct used to store which optional outputs the user asked for*/
+typedef struct _runoptions {
+    int OutputMode;
+    long long Every;//with OUTPUT_SAMPLED, print one line of the table every this many references
+    char CSVFile[256];
+    char ResultFile[256];
+    int BestHitRate;
+    int Sweep;
+    char BatchFile[256];
+    int Threads;
+    int NumLowerLevels;//levels of the hierarchy below the L1 cache, 0 for a single cache
+    Memory Levels[MAX_CACHE_LEVELS - 1];
+    int Inclusion;
+    double SampleFraction;//fraction of the sets simulated, 0 to simulate all of them
+    int Validate;//with SampleFraction, also simulate every set to measure the error
+    int Classify;//classify every miss as compulsory, capacity or conflict
+    int PrefetchKind;//PREFETCH_NONE or the prefetcher attached to the cache
+    int PrefetchDegree;
+    int PrefetchDistance;
+    char SaveFile[256];//snapshot written at the end, or after SaveAt / every SaveEvery references
+    long long SaveAt;
+    long long SaveEvery;
+    char LoadFile[256];//snapshot the run starts from
+    int ResetCounters;//after loading, count only the references that follow
+    long long Length;//references simulated before stopping, 0 for all of them
+    GeneratorConfig Generator;//synthetic traces for --bench and --generate
+    int Generate;//write a generated trace to the file instead of simulating
+    int SelfTest;
+    BenchConfig Bench;
+    int Cores;//private caches kept coherent with MESI, 0 for a single cache
+    char RingName[256];//shared memory ring the references are read from instead of a file
+    long long RingSlots;
+    TlbConfig Tlb;
+} RunOptions;
+
+/*struct used to buffer large amounts of text output, numbers are formatted by hand*/
+typedef struct _outputbuffer {
+    FILE *fp;
+    char *buffer;
+    size_t used;
+} OutputBuffer;
+/*struct used to report the results of simulating one configuration*/
+typedef struct _results {
+    Memory config;
+    long long NumberofMemoryReferences;
+    long long Hits;
+    CacheCounters Counters;
+    double AverageAccessTime;//cycles
+    double Seconds;
+} Results;
 
 //below are the function declarations used 
-FileContents *ReadFile();
-MemoryLocationTable *CreateMemLocTable();
-int CalculateMainMemBlkNum();
-int CalculateCacheMemBlkNum();
-int CalculateCacheMemSetNum();
-void CalculateBestPossibleHitRate();
-Cache CreateCache();
+static int ReadFile();
+static int SweepCacheSizes();
+static int SimulateHierarchy();
+static int SimulateMultiCore();
+static CacheState *InitializeCache();
+static MemoryLocationTable *CreateMemLocTable();
+static int CalculateCacheMemBlkNum();
+static void SelectSimulationKernel();
+static void SimulateReferences();
+static void CalculateBestPossibleHitRate();
+static void AddCacheCounters();
+static MissClassifier* NewMissClassifier();
+static int ClassifyMiss();
+static void PrintMissClassification();
+static void FreeMissClassifier();
+static Prefetcher* NewPrefetcher();
+static int GenerateTraceFile();
+static int RunBenchmark();
+static void FreePrefetcher();
+static void PrintPrefetchCounters();
 
 /*This function takes input from the user and stores it in a struct to 
 be passed to other functions to create the cache and main memory tables*/
-Memory* GetUserData(char *filename) {
+static Memory* GetUserData(char *filename) {
     Memory *userinput = (Memory*)malloc(sizeof(Memory));
 
     printf("Enter the size of main memory in bytes: ");
-    scanf("%d", &userinput->MainMemorySize);
+    scanf("%lld", &userinput->MainMemorySize);
     printf("Enter the size of the cache in bytes: ");
     scanf("%d", &userinput->CacheSize);
     printf("Enter the cache block/line size: ");
     scanf("%d", &userinput->CacheBlockSize);
     printf("Enter the degree of set-associativity (input n for an n-way set-associative mapping): ");
     scanf("%d", &userinput->SetAssoc);
-    printf("Enter the replacement policy (L = LRU , F = FIFO) : ");
+    printf("Enter the replacement policy (L = LRU , F = FIFO , P = tree-PLRU , S = SRRIP , B = BRRIP , U = LFU , R = random) : ");
     scanf("%s", userinput->ReplacementPolicy);
     printf("Enter the write policy (B = write-back , T = write-through) : ");
     scanf("%s", userinput->WritePolicy);
+    userinput->HitLatency = DEFAULT_HIT_LATENCY;
+    userinput->MissPenalty = DEFAULT_MISS_PENALTY;
+    userinput->WordSize = DEFAULT_WORD_SIZE;
     printf("Enter the name of the input file containing the list of memory references generated by the CPU: ");
     scanf("%s", filename);
     printf("%s\n", filename);
-    
+
     return userinput;
 }
 
-/*This function reads the input file and stores the info in a struct*/
-FileContents* ReadFile(char *filename, Memory *userinput, Size *BytesAndBits) {
+/*This function maps a binary memory reference file into memory and checks its header*/
+static TraceReader* OpenBinaryTraceFile(char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("FILE NOT FOUND\n");
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < BINARY_TRACE_HEADER_SIZE) {
+        printf("INVALID BINARY FILE\n");
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);//the mapping keeps the file open
+    if (map == MAP_FAILED) {
+        printf("COULD NOT MAP FILE\n");
+        return NULL;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    const unsigned char *header = (const unsigned char*)map;
+    if ((header[4] != BINARY_TRACE_VERSION && header[4] != BINARY_TRACE_VERSION_CORES) || (header[5] != 32 && header[5] != 64)) {
+        printf("UNSUPPORTED BINARY FILE VERSION\n");
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    TraceReader *reader = (TraceReader*)calloc(1, sizeof(TraceReader));
+    reader->Binary = 1;
+    reader->AddressBits = header[5];
+    reader->HasCores = header[4] == BINARY_TRACE_VERSION_CORES;
+    reader->map = header;
+    reader->mapLength = st.st_size;
+    reader->cursor = header + BINARY_TRACE_HEADER_SIZE;
+    reader->end = header + st.st_size;
+    for (int i = 7; i >= 0; i--) {
+        reader->NumberofMemoryReferences = (reader->NumberofMemoryReferences << 8) | header[8 + i];
+    }
+    return reader;
+}
+
+/*This function opens the input file and reads the number of memory references
+from the first line, the references themselves are read later one at a time.
+Binary files are recognized by their header and handed to OpenBinaryTraceFile*/
+static TraceReader* OpenTraceFile(char *filename) {
+    FILE *fp = fopen(filename, "r");
+    if (!fp) {
+        printf("FILE NOT FOUND\n");
+        return NULL;
+    }
+    char magic[4];
+    if (fread(magic, 1, 4, fp) == 4 && memcmp(magic, BINARY_TRACE_MAGIC, 4) == 0) {
+        fclose(fp);
+        return OpenBinaryTraceFile(filename);
+    }
+    rewind(fp);
+    TraceReader *reader = (TraceReader*)calloc(1, sizeof(TraceReader));
+    reader->fp = fp;
+    reader->buffer = (char*)malloc(TRACE_CHUNK_SIZE);
+    reader->AddressBits = 32;
+    if (fscanf(fp, "%lld", &reader->NumberofMemoryReferences) != 1) {
+        reader->NumberofMemoryReferences = 0;
+    }
+    return reader;
+}
 
-    FileContents *txtFileContents = (FileContents*)malloc(sizeof(FileContents));
-    FILE *fp;
-    fp = fopen(filename, "r");
+/*layout of the start of a shared memory ring (--ring), the slots follow at
+TRACE_RING_HEADER_SIZE, one CacheSimReference each. Head and Tail count the
+references since the ring was created and sit on their own cache lines*/
+typedef struct _traceringheader {
+    char Magic[4];
+    uint32_t Version;
+    uint64_t Slots;//a power of two
+    _Alignas(64) _Atomic uint64_t Head;//next reference to read, written by the simulator
+    _Alignas(64) _Atomic uint64_t Tail;//next free slot, written by the tracing process
+    _Alignas(64) _Atomic uint32_t Closed;//set by the tracing process after its last reference
+    _Atomic uint32_t ProducerPid;//0 until a tracing process attaches
+    uint32_t ConsumerPid;
+} TraceRingHeader;
+_Static_assert(sizeof(TraceRingHeader) <= TRACE_RING_HEADER_SIZE, "ring header too large");
 
-    if (!filename) {
-    printf("FILE NOT FOUND\n");
-    return NULL;
+/*struct used by either side of a shared memory ring. As in Ring, each side keeps a
+private copy of the other side's index and only publishes its own now and then*/
+struct _tracering {
+    TraceRingHeader *header;
+    CacheSimReference *slots;
+    uint64_t mask;
+    size_t mapLength;
+    uint64_t index;//tail of the tracing process, head of the simulator
+    uint64_t other;//copy of the other side's index
+    char name[TRACE_RING_NAME_SIZE];//shared memory object, removed by the simulator that created it
+};
+
+//shared memory object names start with a slash, which the user may leave out
+static void TraceRingObjectName(const char *name, char *object, size_t size) {
+    snprintf(object, size, "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+//true once the process that attached to the other side of a ring has exited
+static int RingProcessGone(uint32_t pid) {
+    return pid != 0 && kill((pid_t)pid, 0) != 0 && errno == ESRCH;
+}
+
+//waits a little while a ring is empty or full: yields first, then sleeps so an idle ring costs no CPU
+static void RingBackoff(int *spins) {
+    if (++*spins < TRACE_RING_SPINS) {
+        sched_yield();
+    }
+    else {
+        struct timespec pause = {0, TRACE_RING_SLEEP_NS};
+        nanosleep(&pause, NULL);
+    }
+}
+
+/*This function creates the shared memory ring name with room for slots references,
+a power of two, and returns a reader that takes the references from it as a tracing
+process adds them. The ring is removed again by CloseTraceFile*/
+static TraceReader* OpenTraceRing(char *name, long long slots) {
+    char object[TRACE_RING_NAME_SIZE];
+    TraceRingObjectName(name, object, sizeof(object));
+    int fd = shm_open(object, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        printf("COULD NOT CREATE SHARED MEMORY RING %s\n", object);
+        return NULL;
+    }
+    size_t length = TRACE_RING_HEADER_SIZE + sizeof(CacheSimReference) * (size_t)slots;
+    void *map = ftruncate(fd, length) == 0 ? mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("COULD NOT MAP SHARED MEMORY RING %s\n", object);
+        shm_unlink(object);
+        return NULL;
+    }
+    TraceRing *ring = (TraceRing*)calloc(1, sizeof(TraceRing));
+    ring->header = (TraceRingHeader*)map;
+    ring->slots = (CacheSimReference*)((char*)map + TRACE_RING_HEADER_SIZE);
+    ring->mask = (uint64_t)slots - 1;
+    ring->mapLength = length;
+    snprintf(ring->name, sizeof(ring->name), "%s", object);
+    //the new object is all zeros, so the indexes and flags start out right, and the
+    //magic is written last so a tracing process never attaches to a half made ring
+    ring->header->Slots = (uint64_t)slots;
+    ring->header->Version = TRACE_RING_VERSION;
+    ring->header->ConsumerPid = (uint32_t)getpid();
+    atomic_thread_fence(memory_order_release);
+    memcpy(ring->header->Magic, TRACE_RING_MAGIC, 4);
+    TraceReader *reader = (TraceReader*)calloc(1, sizeof(TraceReader));
+    reader->ring = ring;
+    reader->AddressBits = 64;
+    reader->NumberofMemoryReferences = LLONG_MAX;//until the tracing process closes the ring
+    printf("Waiting for memory references on shared memory ring %s (%lld slots)\n", object, slots);
+    fflush(stdout);
+    return reader;
+}
+
+/*waits for references in the ring and copies up to max of them into block, returns 0
+once the tracing process has closed the ring and every reference in it has been read*/
+static int ReadRingBlock(TraceReader *reader, FileContents *block, int max) {
+    TraceRing *ring = reader->ring;
+    TraceRingHeader *header = ring->header;
+    int spins = 0;
+    while (ring->index == ring->other) {
+        //Closed is read before Tail, so once it is set the tail read after it is the final one
+        int closed = atomic_load_explicit(&header->Closed, memory_order_acquire);
+        ring->other = atomic_load_explicit(&header->Tail, memory_order_acquire);
+        if (ring->index != ring->other) {
+            break;
+        }
+        if (closed) {
+            return 0;
+        }
+        if (spins >= TRACE_RING_SPINS && RingProcessGone(atomic_load_explicit(&header->ProducerPid, memory_order_relaxed))) {
+            printf("THE TRACING PROCESS EXITED WITHOUT CLOSING THE RING\n");
+            return 0;
+        }
+        RingBackoff(&spins);
+    }
+    uint64_t available = ring->other - ring->index;
+    int n = available < (uint64_t)max ? (int)available : max;
+    for (int i = 0; i < n; i++) {
+        const CacheSimReference *slot = &ring->slots[(ring->index + i) & ring->mask];
+        block[i].Address = slot->Address;
+        block[i].ReadOrWrite = slot->Write ? 1 : 0;
+        block[i].Core = (int)slot->Core;
+        block[i].NumberofMemoryReferences = 0;
+    }
+    ring->index += n;
+    atomic_store_explicit(&header->Head, ring->index, memory_order_release);
+    reader->ReferencesRead += n;
+    return n;
+}
+
+TraceRing* TraceRingAttach(const char *name) {
+    char object[TRACE_RING_NAME_SIZE];
+    TraceRingObjectName(name, object, sizeof(object));
+    int fd = shm_open(object, O_RDWR, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= TRACE_RING_HEADER_SIZE) {
+        map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    TraceRingHeader *header = (TraceRingHeader*)map;
+    uint32_t none = 0;
+    //a ring has a single producer, a second tracing process is turned away
+    if (memcmp(header->Magic, TRACE_RING_MAGIC, 4) != 0 || header->Version != TRACE_RING_VERSION ||
+        TRACE_RING_HEADER_SIZE + sizeof(CacheSimReference) * header->Slots != (uint64_t)st.st_size ||
+        !atomic_compare_exchange_strong(&header->ProducerPid, &none, (uint32_t)getpid())) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    TraceRing *ring = (TraceRing*)calloc(1, sizeof(TraceRing));
+    ring->header = header;
+    ring->slots = (CacheSimReference*)((char*)map + TRACE_RING_HEADER_SIZE);
+    ring->mask = header->Slots - 1;
+    ring->mapLength = st.st_size;
+    ring->index = atomic_load_explicit(&header->Tail, memory_order_relaxed);
+    ring->other = atomic_load_explicit(&header->Head, memory_order_acquire);
+    return ring;
+}
+
+void TraceRingFlush(TraceRing *ring) {
+    atomic_store_explicit(&ring->header->Tail, ring->index, memory_order_release);
+}
+
+/*if the simulator exits while the ring is full the reference is dropped instead of
+stalling the tracing process for good*/
+void TraceRingPush(TraceRing *ring, uint64_t address, int write, int core) {
+    int spins = 0;
+    while (ring->index - ring->other > ring->mask) {//looks full
+        ring->other = atomic_load_explicit(&ring->header->Head, memory_order_acquire);
+        if (ring->index - ring->other > ring->mask) {
+            TraceRingFlush(ring);
+            if (spins >= TRACE_RING_SPINS && RingProcessGone(ring->header->ConsumerPid)) {
+                return;
+            }
+            RingBackoff(&spins);
+        }
+    }
+    CacheSimReference *slot = &ring->slots[ring->index & ring->mask];
+    slot->Address = address;
+    slot->Write = write != 0;
+    slot->Core = (uint32_t)core;
+    ring->index++;
+    if ((ring->index & (RING_PUBLISH_BATCH - 1)) == 0) {
+        TraceRingFlush(ring);
+    }
+}
+
+void TraceRingClose(TraceRing *ring) {
+    TraceRingFlush(ring);
+    atomic_store_explicit(&ring->header->Closed, 1, memory_order_release);
+    munmap(ring->header, ring->mapLength);
+    free(ring);
+}
+
+/*returns the next character in the file without consuming it, the next
+chunk is read in whenever the current one runs out*/
+static int PeekTraceChar(TraceReader *reader) {
+    if (reader->pos == reader->length) {
+        if (reader->eof) {
+            return EOF;
+        }
+        reader->length = fread(reader->buffer, 1, TRACE_CHUNK_SIZE, reader->fp);
+        reader->pos = 0;
+        if (reader->length == 0) {
+            reader->eof = 1;
+            return EOF;
+        }
     }
-    int num;
-    fscanf(fp, "%d", &num);//stores the number of mem reference lines
-    txtFileContents->NumberofMemoryReferences = num;
-    FileContents *Matrix[num];
-        for (int i = 0; i < num; i++) {
-            Matrix[i] = (FileContents*)malloc(sizeof(FileContents));
+    return (unsigned char)reader->buffer[reader->pos];
+}
+
+/*decodes one varint at *cursor and moves the cursor past it, returns 0 if the data ends first*/
+static inline int DecodeVarint(const unsigned char **cursor, const unsigned char *end, uint64_t *value) {
+    const unsigned char *p = *cursor;
+    if (p < end && *p < 0x80) {//most records fit in a single byte
+        *value = *p++;
+    }
+    else {
+        *value = 0;
+        int shift = 0;
+        for (;;) {
+            if (p >= end || shift > 63) {
+                return 0;//truncated file
+            }
+            unsigned char byte = *p++;
+            *value |= (uint64_t)(byte & 0x7f) << shift;
+            if (byte < 0x80) {
+                break;
+            }
+            shift += 7;
+        }
+    }
+    *cursor = p;
+    return 1;
+}
+
+/*decodes the next record of a binary file straight out of the mapping*/
+static inline int DecodeBinaryReference(TraceReader *reader, FileContents *ref) {
+    const unsigned char *p = reader->cursor;
+    uint64_t value;
+    uint64_t core = 0;
+    if (!DecodeVarint(&p, reader->end, &value) || (reader->HasCores && !DecodeVarint(&p, reader->end, &core))) {
+        return 0;
+    }
+    reader->cursor = p;
+    uint64_t zigzag = value >> 1;
+    int64_t delta = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+    reader->PreviousAddress += delta;
+    ref->ReadOrWrite = (int)(value & 1);
+    ref->Address = (uint64_t)reader->PreviousAddress;
+    ref->Core = (int)core;
+    ref->NumberofMemoryReferences = (int)reader->NumberofMemoryReferences;
+    reader->ReferencesRead++;
+    return 1;
+}
+
+/*This function reads the next R/W and address pair from the file, returns 0
+once all of the memory references listed in the header have been read*/
+static int NextMemoryReference(TraceReader *reader, FileContents *ref) {
+    if (reader->ReferencesRead >= reader->NumberofMemoryReferences) {
+        return 0;
+    }
+    if (reader->ring) {
+        return ReadRingBlock(reader, ref, 1);
+    }
+    if (reader->Binary) {
+        return DecodeBinaryReference(reader, ref);
+    }
+    int c;
+    //skip the whitespace before the R/W token
+    while ((c = PeekTraceChar(reader)) == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        reader->pos++;
+    }
+    if (c == EOF) {
+        return 0;
     }
-    //create an array of struct type FileContents to store each line
-    FileContents matrixtry[num];
     char str[5];
-    int intparser;
-    int array[num];
-    int i = 0;
-    //scan W/R and memory address
-    while (fscanf(fp, "%s %d\n", str, &intparser) != EOF) {
-        //stores R/W data as an integer 0 or 1
-        if (strcmp(str, "R") == 0) {
-            matrixtry[i].ReadOrWrite = 0;
-            array[i] = 0;
-        }
-        if (strcmp(str, "W") == 0) {
-            matrixtry[i].ReadOrWrite = 1;
-            array[i] = 1;
-        }
-        matrixtry[i].Address = intparser;
-        matrixtry[i].NumberofMemoryReferences = num;
-      i++;
+    int len = 0;
+    while ((c = PeekTraceChar(reader)) != EOF && c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+        if (len < 4) {
+            str[len++] = (char)c;
+        }
+        reader->pos++;
     }
-    fclose(fp);
-    //call function below at the end to create the memory location table
-    CreateMemLocTable(matrixtry, userinput, BytesAndBits);
-    return *Matrix;//was returning txtFileContents so this could cause some problems
+    str[len] = '\0';
+    while ((c = PeekTraceChar(reader)) == ' ' || c == '\t') {
+        reader->pos++;
+    }
+    int negative = 0;
+    if (c == '-' || c == '+') {
+        negative = (c == '-');
+        reader->pos++;
+    }
+    uint64_t address = 0;
+    while ((c = PeekTraceChar(reader)) >= '0' && c <= '9') {
+        address = address * 10 + (c - '0');
+        reader->pos++;
+    }
+    //multi-core traces name the core after the address
+    while ((c = PeekTraceChar(reader)) == ' ' || c == '\t') {
+        reader->pos++;
+    }
+    int core = 0;
+    while ((c = PeekTraceChar(reader)) >= '0' && c <= '9') {
+        core = core * 10 + (c - '0');
+        reader->pos++;
+    }
+    ref->Core = core;
+    //stores R/W data as an integer 0 or 1
+    if (strcmp(str, "R") == 0) {
+        ref->ReadOrWrite = 0;
+    }
+    else if (strcmp(str, "W") == 0) {
+        ref->ReadOrWrite = 1;
+    }
+    else {
+        ref->ReadOrWrite = -1;
+    }
+    ref->Address = negative ? 0 - address : address;
+    ref->NumberofMemoryReferences = (int)reader->NumberofMemoryReferences;
+    reader->ReferencesRead++;
+    return 1;
+}
+
+/*This function fills block with up to max memory references and returns how many were read,
+binary files are decoded in a tight loop without going through the text parser*/
+static int ReadReferenceBlock(TraceReader *reader, FileContents *block, int max) {
+    long long remaining = reader->NumberofMemoryReferences - reader->ReferencesRead;
+    if (remaining < max) {
+        max = remaining > 0 ? (int)remaining : 0;
+    }
+    int n = 0;
+    if (reader->ring) {
+        return max > 0 ? ReadRingBlock(reader, block, max) : 0;
+    }
+    if (reader->Binary) {
+        while (n < max && DecodeBinaryReference(reader, &block[n])) {
+            n++;
+        }
+    }
+    else {
+        while (n < max && NextMemoryReference(reader, &block[n])) {
+            n++;
+        }
+    }
+    return n;
+}
+
+/*closes the input file and frees the chunk buffer or unmaps the binary file,
+a shared memory ring is unmapped and removed*/
+static void CloseTraceFile(TraceReader *reader) {
+    if (reader->ring) {
+        munmap(reader->ring->header, reader->ring->mapLength);
+        shm_unlink(reader->ring->name);
+        free(reader->ring);
+    }
+    else if (reader->Binary) {
+        if (reader->map) {
+            munmap((void*)reader->map, reader->mapLength);
+        }
+    }
+    else {
+        fclose(reader->fp);
+        free(reader->buffer);
+    }
+    free(reader);
+}
+
+/*encodes value as a varint at out and returns its length, at most 10 bytes*/
+static inline int EncodeVarint(unsigned char *out, uint64_t value) {
+    int n = 0;
+    while (value >= 0x80) {
+        out[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char)value;
+    return n;
+}
+
+/*encodes one binary record at out and returns its length, at most 10 bytes*/
+static inline int EncodeBinaryReference(unsigned char *out, FileContents *ref, int64_t *previous) {
+    int64_t delta = (int64_t)(ref->Address - (uint64_t)*previous);
+    *previous = (int64_t)ref->Address;
+    uint64_t zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+    return EncodeVarint(out, (zigzag << 1) | (ref->ReadOrWrite == 1));
+}
+
+/*appends one binary record to the output buffer, with its core id when cores is set,
+flushing the buffer when it is nearly full*/
+static void WriteBinaryReference(FILE *out, unsigned char *buffer, size_t *used, FileContents *ref, int64_t *previous, int cores) {
+    if (*used > TRACE_CHUNK_SIZE - 32) {
+        fwrite(buffer, 1, *used, out);
+        *used = 0;
+    }
+    *used += EncodeBinaryReference(buffer + *used, ref, previous);
+    if (cores) {
+        *used += EncodeVarint(buffer + *used, (uint64_t)ref->Core);
+    }
+}
+
+/*This function reads every remaining reference of a text file into a malloc'd buffer
+of binary records (without the header) and returns it, the length goes in length*/
+static unsigned char* EncodeTraceBuffer(TraceReader *reader, size_t *length) {
+    size_t capacity = TRACE_CHUNK_SIZE;
+    size_t used = 0;
+    unsigned char *buffer = (unsigned char*)malloc(capacity);
+    int64_t previous = 0;
+    FileContents ref;
+    while (NextMemoryReference(reader, &ref)) {
+        if (used + 16 > capacity) {
+            capacity *= 2;
+            buffer = (unsigned char*)realloc(buffer, capacity);
+        }
+        used += EncodeBinaryReference(buffer + used, &ref, &previous);
+    }
+    *length = used;
+    return buffer;
+}
+
+/*returns a reader that decodes binary records from a buffer in memory, the buffer is
+only read so any number of readers can share it*/
+static TraceReader* OpenTraceBuffer(const unsigned char *data, size_t length, long long count, int addressBits) {
+    TraceReader *reader = (TraceReader*)calloc(1, sizeof(TraceReader));
+    reader->Binary = 1;
+    reader->AddressBits = addressBits;
+    reader->cursor = data;
+    reader->end = data + length;
+    reader->NumberofMemoryReferences = count;
+    return reader;
+}
+
+/*This function converts a text memory reference file into the binary format,
+returns 0 on success. A trace that names any core other than 0 is read twice, the
+first time to find that out, and written as a version 2 file with the core ids*/
+static int ConvertTraceFile(char *textfile, char *binaryfile) {
+    TraceReader *reader = OpenTraceFile(textfile);
+    if (!reader) {
+        return -1;
+    }
+    if (reader->Binary) {
+        printf("%s is already a binary file\n", textfile);
+        CloseTraceFile(reader);
+        return -1;
+    }
+    int cores = 0;
+    FileContents ref;
+    while (!cores && NextMemoryReference(reader, &ref)) {
+        cores = ref.Core != 0;
+    }
+    CloseTraceFile(reader);
+    reader = OpenTraceFile(textfile);
+    if (!reader) {
+        return -1;
+    }
+    FILE *out = fopen(binaryfile, "wb");
+    if (!out) {
+        printf("COULD NOT CREATE %s\n", binaryfile);
+        CloseTraceFile(reader);
+        return -1;
+    }
+    //header is written again at the end once the real number of references is known
+    unsigned char header[BINARY_TRACE_HEADER_SIZE] = {0};
+    fwrite(header, 1, BINARY_TRACE_HEADER_SIZE, out);
+    unsigned char *buffer = (unsigned char*)malloc(TRACE_CHUNK_SIZE);
+    size_t used = 0;
+    int64_t previous = 0;
+    while (NextMemoryReference(reader, &ref)) {
+        WriteBinaryReference(out, buffer, &used, &ref, &previous, cores);
+    }
+    fwrite(buffer, 1, used, out);
+    long long count = reader->ReferencesRead;
+    memcpy(header, BINARY_TRACE_MAGIC, 4);
+    header[4] = cores ? BINARY_TRACE_VERSION_CORES : BINARY_TRACE_VERSION;
+    header[5] = (unsigned char)reader->AddressBits;
+    for (int i = 0; i < 8; i++) {
+        header[8 + i] = (unsigned char)(count >> (8 * i));
+    }
+    fseek(out, 0, SEEK_SET);
+    fwrite(header, 1, BINARY_TRACE_HEADER_SIZE, out);
+    long binarysize = (fseek(out, 0, SEEK_END) == 0) ? ftell(out) : 0;
+    long textsize = (fseek(reader->fp, 0, SEEK_END) == 0) ? ftell(reader->fp) : 0;
+    fclose(out);
+    free(buffer);
+    CloseTraceFile(reader);
+    printf("Converted %lld memory references: %ld bytes -> %ld bytes (%.1fx smaller)\n",
+           count, textsize, binarysize, binarysize ? (double)textsize / binarysize : 0.0);
+    return 0;
+}
+
+/*This function opens the input file, or the shared memory ring of --ring, and
+streams its memory references through the cache*/
+static int ReadFile(char *filename, Memory *userinput, Size *BytesAndBits, RunOptions *options) {
+    TraceReader *reader = options->RingName[0] ? OpenTraceRing(options->RingName, options->RingSlots) : OpenTraceFile(filename);
+    if (!reader) {
+        return -1;
+    }
+    int status = 0;
+    if (options->Sweep) {
+        status = SweepCacheSizes(reader, userinput);
+    }
+    else if (options->NumLowerLevels > 0) {
+        status = SimulateHierarchy(reader, userinput, options);
+    }
+    else if (options->Cores > 0) {
+        status = SimulateMultiCore(reader, userinput, options);
+    }
+    else {
+        //call function below to run the references through the cache
+        CreateMemLocTable(reader, userinput, BytesAndBits, options);
+    }
+    CloseTraceFile(reader);
+    return status;
 }
+//returns the number of whole bits in n (log2 rounded down), 0 for n <= 1
+static inline int FloorLog2(long long n) {
+    return n > 1 ? 63 - __builtin_clzll((unsigned long long)n) : 0;
+}
+
 /*This funcation calculates the cache size characterisitics and returns them as a struct*/
-Size* CalculateSize(Memory *userinput) {
+static Size* CalculateSize(Memory *userinput) {
     Size *BytesAndBits = (Size*)malloc(sizeof(Size));
 
-    BytesAndBits->AddressBits = log2(userinput->MainMemorySize);
-    BytesAndBits->OffsetBits = log2(userinput->CacheBlockSize);
-    BytesAndBits->IndexBits = log2(userinput->CacheSize/(userinput->CacheBlockSize*userinput->SetAssoc));
+    BytesAndBits->AddressBits = FloorLog2(userinput->MainMemorySize);
+    BytesAndBits->OffsetBits = FloorLog2(userinput->CacheBlockSize);
+    BytesAndBits->IndexBits = FloorLog2(userinput->CacheSize/(userinput->CacheBlockSize*userinput->SetAssoc));
     BytesAndBits->TagBits = BytesAndBits->AddressBits-(BytesAndBits->OffsetBits + BytesAndBits->IndexBits);
     BytesAndBits->NumCacheBlocks = userinput->CacheSize / userinput->CacheBlockSize;
     BytesAndBits->NumCacheSets = BytesAndBits->NumCacheBlocks / userinput->SetAssoc;
-    BytesAndBits->TotalTagBits = (BytesAndBits->TagBits * BytesAndBits->NumCacheBlocks) / 8; 
+    BytesAndBits->TotalTagBits = (int)(((long long)BytesAndBits->TagBits * BytesAndBits->NumCacheBlocks) / 8); 
     BytesAndBits->ValidBit = BytesAndBits->NumCacheBlocks / 8;
-    BytesAndBits->DirtyBit = BytesAndBits->ValidBit;
+    //only write-back caches need a dirty bit per block
+    BytesAndBits->DirtyBit = strcmp(userinput->WritePolicy, "B") == 0 ? BytesAndBits->ValidBit : 0;
     BytesAndBits->TotalCacheSize = userinput->CacheSize + BytesAndBits->TotalTagBits + BytesAndBits->ValidBit + BytesAndBits->DirtyBit;
-    
+
     return BytesAndBits;
 }
 /*print function to print cache size data */
-void PrintBytesAndBits(Size *BytesAndBits) {
+static void PrintBytesAndBits(Size *BytesAndBits) {
     printf("Total address lines required: %d\n", BytesAndBits->AddressBits); 
     printf("Number of bits for offset: %d\n", BytesAndBits->OffsetBits);
     printf("Number of bits for index: %d\n", BytesAndBits->IndexBits);
@@ -168,358 +1125,4830 @@ void PrintBytesAndBits(Size *BytesAndBits) {
     return;
 }
 
-/* this function creates the memory table  */
-MemoryLocationTable* CreateMemLocTable(FileContents *filecontents, Memory *userinput, Size *BytesAndBits) {
-    MemoryLocationTable *table = (MemoryLocationTable*)malloc(sizeof(MemoryLocationTable));
-    int size =  userinput->CacheSize / userinput->CacheBlockSize;
+/*
+Replacement policies. Every policy keeps StateBytes(ways) bytes of state per
+set and is told about every hit and fill, the cache itself always fills an
+invalid way before asking the policy for a victim. Policies that need random
+numbers keep their own generator in the set's state, so what happens in one
+set never depends on the others and sets can be simulated in any order.
+*/
+
+//returns the smallest power of two that is >= n
+static inline int NextPowerOfTwo(int n) {
+    int p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+//the hit, fill and victim functions of the policies are inlined into the specialized
+//simulation kernels, see SelectSimulationKernel, and called through the table elsewhere
+#define POLICY_INLINE inline __attribute__((always_inline))
+
+/*small xorshift generator used by the random and BRRIP policies, seeded per set*/
+static inline uint64_t SeedRandom(int set) {
+    uint64_t x = 0x9e3779b97f4a7c15ULL * (uint64_t)(set + 1);
+    return (x ^ (x >> 31)) | 1;
+}
+static inline uint64_t NextRandom(uint64_t *rng) {
+    uint64_t x = *rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *rng = x;
+    return x;
+}
+
+/*true LRU: a doubly linked list of the ways, most recently used at the head,
+each update unlinks one way and pushes it on the head so it is O(1)
+layout: uint16 head, uint16 tail, uint16 next[ways], uint16 prev[ways]*/
+static size_t LRUStateBytes(int ways) {
+    return sizeof(uint16_t) * (2 + 2 * (size_t)ways);
+}
+static void LRUInit(unsigned char *state, int ways, int set) {
+    uint16_t *list = (uint16_t*)state;
+    uint16_t *next = list + 2;
+    uint16_t *prev = next + ways;
+    list[0] = 0;
+    list[1] = (uint16_t)(ways - 1);
+    for (int w = 0; w < ways; w++) {
+        next[w] = (uint16_t)(w + 1);
+        prev[w] = (uint16_t)(w - 1);
+    }
+}
+static POLICY_INLINE void LRUTouch(unsigned char *state, int ways, int way) {
+    uint16_t *list = (uint16_t*)state;
+    uint16_t *next = list + 2;
+    uint16_t *prev = next + ways;
+    if (list[0] == way) {
+        return;
+    }
+    //unlink the way, it is not the head so it has a previous way, and the tail has no next way
+    if (list[1] == way) {
+        list[1] = prev[way];
+    }
+    else {
+        prev[next[way]] = prev[way];
+    }
+    next[prev[way]] = next[way];
+    //and push it on the head
+    next[way] = list[0];
+    prev[list[0]] = (uint16_t)way;
+    list[0] = (uint16_t)way;
+}
+static POLICY_INLINE int LRUVictim(unsigned char *state, int ways) {
+    return ((uint16_t*)state)[1];
+}
+
+/*FIFO: the ways in fill order, kept in the same list as LRU but only moved when a
+block is filled. A single pointer to the oldest way would go wrong once a way is
+invalidated (coherence, back-invalidation) and refilled out of turn*/
+static size_t FIFOStateBytes(int ways) {
+    return LRUStateBytes(ways);
+}
+static void FIFOInit(unsigned char *state, int ways, int set) {
+    LRUInit(state, ways, set);
+}
+static POLICY_INLINE void FIFOHit(unsigned char *state, int ways, int way) {
+}
+static POLICY_INLINE void FIFOFill(unsigned char *state, int ways, int way) {
+    LRUTouch(state, ways, way);
+}
+static POLICY_INLINE int FIFOVictim(unsigned char *state, int ways) {
+    return LRUVictim(state, ways);
+}
+
+/*tree pseudo-LRU: one bit per node of a binary tree over the ways (rounded up
+to a power of two), each bit points to the half that was used less recently.
+Node n has children 2n and 2n+1, the root is node 1*/
+static size_t PLRUStateBytes(int ways) {
+    return (NextPowerOfTwo(ways) + 7) / 8;
+}
+static void PLRUInit(unsigned char *state, int ways, int set) {
+    memset(state, 0, PLRUStateBytes(ways));
+}
+static POLICY_INLINE void PLRUTouch(unsigned char *state, int ways, int way) {
+    int leaves = NextPowerOfTwo(ways);
+    int node = 1;
+    for (int half = leaves >> 1; half > 0; half >>= 1) {
+        int right = (way & half) != 0;
+        //point the node away from the way just used
+        if (right) {
+            state[node >> 3] &= (unsigned char)~(1 << (node & 7));
+        }
+        else {
+            state[node >> 3] |= (unsigned char)(1 << (node & 7));
+        }
+        node = 2 * node + right;
+    }
+}
+static POLICY_INLINE int PLRUVictim(unsigned char *state, int ways) {
+    int leaves = NextPowerOfTwo(ways);
+    int node = 1;
+    int way = 0;
+    for (int half = leaves >> 1; half > 0; half >>= 1) {
+        int right = (state[node >> 3] >> (node & 7)) & 1;
+        //padding leaves past the last way only exist on the right
+        if (right && way + half >= ways) {
+            right = 0;
+        }
+        way += right ? half : 0;
+        node = 2 * node + right;
+    }
+    return way;
+}
+
+/*SRRIP and BRRIP: a 2 bit re-reference prediction value per way, stored as
+two bit planes (high bits then low bits) so finding a way predicted to be
+re-referenced furthest in the future (value 3) and aging every way of the
+set are a few word operations*/
+static size_t RRIPStateBytes(int ways) {
+    return 2 * sizeof(uint64_t) * (size_t)((ways + 63) / 64);
+}
+static void RRIPInit(unsigned char *state, int ways, int set) {
+    memset(state, 0, RRIPStateBytes(ways));
+}
+//BRRIP keeps its generator after the two bit planes
+static size_t BRRIPStateBytes(int ways) {
+    return RRIPStateBytes(ways) + sizeof(uint64_t);
+}
+static void BRRIPInit(unsigned char *state, int ways, int set) {
+    RRIPInit(state, ways, set);
+    *(uint64_t*)(state + RRIPStateBytes(ways)) = SeedRandom(set);
+}
+static inline void RRIPSet(unsigned char *state, int ways, int way, int value) {
+    int words = (ways + 63) / 64;
+    uint64_t *hi = (uint64_t*)state;
+    uint64_t *lo = hi + words;
+    uint64_t bit = (uint64_t)1 << (way & 63);
+    hi[way >> 6] = (value & 2) ? (hi[way >> 6] | bit) : (hi[way >> 6] & ~bit);
+    lo[way >> 6] = (value & 1) ? (lo[way >> 6] | bit) : (lo[way >> 6] & ~bit);
+}
+static POLICY_INLINE void RRIPHit(unsigned char *state, int ways, int way) {
+    RRIPSet(state, ways, way, 0);
+}
+static POLICY_INLINE void SRRIPFill(unsigned char *state, int ways, int way) {
+    RRIPSet(state, ways, way, 2);
+}
+static POLICY_INLINE void BRRIPFill(unsigned char *state, int ways, int way) {
+    //bimodal insertion: distant re-reference except for 1 in 32 fills
+    uint64_t *rng = (uint64_t*)(state + RRIPStateBytes(ways));
+    RRIPSet(state, ways, way, (NextRandom(rng) & 31) == 0 ? 2 : 3);
+}
+static POLICY_INLINE int RRIPVictim(unsigned char *state, int ways) {
+    int words = (ways + 63) / 64;
+    uint64_t *hi = (uint64_t*)state;
+    uint64_t *lo = hi + words;
+    uint64_t anyhi = 0;
+    uint64_t anylo = 0;
+    for (int i = 0; i < words; i++) {
+        uint64_t used = (i == words - 1 && (ways & 63)) ? (((uint64_t)1 << (ways & 63)) - 1) : ~(uint64_t)0;
+        uint64_t distant = hi[i] & lo[i] & used;
+        if (distant) {
+            return i * 64 + __builtin_ctzll(distant);
+        }
+        anyhi |= hi[i] & used;
+        anylo |= lo[i] & used;
+    }
+    //no way is at 3 yet, age every way by the amount that brings the largest one to 3
+    for (int i = 0; i < words; i++) {
+        uint64_t used = (i == words - 1 && (ways & 63)) ? (((uint64_t)1 << (ways & 63)) - 1) : ~(uint64_t)0;
+        if (anyhi) {//largest is 2, add 1
+            uint64_t carry = lo[i];
+            lo[i] = ~lo[i] & used;
+            hi[i] |= carry;
+        }
+        else if (anylo) {//largest is 1, add 2
+            hi[i] = used;
+        }
+        else {//everything is 0, add 3
+            hi[i] = used;
+            lo[i] = used;
+        }
+    }
+    for (int i = 0; i < words; i++) {
+        uint64_t distant = hi[i] & lo[i];
+        if (distant) {
+            return i * 64 + __builtin_ctzll(distant);
+        }
+    }
+    return 0;
+}
+
+/*LFU: a saturating access count per way and a binary min-heap of the ways
+ordered by count, so updates are O(log ways) and the victim is the root.
+layout: uint16 heap[ways], uint16 pos[ways], uint8 count[ways]*/
+static size_t LFUStateBytes(int ways) {
+    return (2 * sizeof(uint16_t) + 1) * (size_t)ways;
+}
+static void LFUInit(unsigned char *state, int ways, int set) {
+    uint16_t *heap = (uint16_t*)state;
+    uint16_t *pos = heap + ways;
+    unsigned char *count = (unsigned char*)(pos + ways);
+    for (int w = 0; w < ways; w++) {
+        heap[w] = (uint16_t)w;
+        pos[w] = (uint16_t)w;
+        count[w] = 0;
+    }
+}
+static inline void LFUSwap(uint16_t *heap, uint16_t *pos, int a, int b) {
+    uint16_t t = heap[a];
+    heap[a] = heap[b];
+    heap[b] = t;
+    pos[heap[a]] = (uint16_t)a;
+    pos[heap[b]] = (uint16_t)b;
+}
+//restores the heap after the count of way changed
+static void LFUUpdate(unsigned char *state, int ways, int way) {
+    uint16_t *heap = (uint16_t*)state;
+    uint16_t *pos = heap + ways;
+    unsigned char *count = (unsigned char*)(pos + ways);
+    int i = pos[way];
+    while (i > 0 && count[heap[(i - 1) / 2]] > count[heap[i]]) {
+        LFUSwap(heap, pos, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    for (;;) {
+        int smallest = i;
+        int l = 2 * i + 1;
+        int r = l + 1;
+        if (l < ways && count[heap[l]] < count[heap[smallest]]) {
+            smallest = l;
+        }
+        if (r < ways && count[heap[r]] < count[heap[smallest]]) {
+            smallest = r;
+        }
+        if (smallest == i) {
+            break;
+        }
+        LFUSwap(heap, pos, i, smallest);
+        i = smallest;
+    }
+}
+static POLICY_INLINE void LFUHit(unsigned char *state, int ways, int way) {
+    unsigned char *count = state + 2 * sizeof(uint16_t) * (size_t)ways;
+    if (count[way] == 255) {
+        //halving every count keeps their order so the heap stays valid
+        for (int w = 0; w < ways; w++) {
+            count[w] >>= 1;
+        }
+    }
+    count[way]++;
+    LFUUpdate(state, ways, way);
+}
+static POLICY_INLINE void LFUFill(unsigned char *state, int ways, int way) {
+    unsigned char *count = state + 2 * sizeof(uint16_t) * (size_t)ways;
+    count[way] = 1;
+    LFUUpdate(state, ways, way);
+}
+static POLICY_INLINE int LFUVictim(unsigned char *state, int ways) {
+    return ((uint16_t*)state)[0];
+}
+
+/*random: only the generator, any way is equally likely to be replaced*/
+static size_t RandomStateBytes(int ways) {
+    return sizeof(uint64_t);
+}
+static void RandomInit(unsigned char *state, int ways, int set) {
+    *(uint64_t*)state = SeedRandom(set);
+}
+static POLICY_INLINE void RandomTouch(unsigned char *state, int ways, int way) {
+}
+static POLICY_INLINE int RandomVictim(unsigned char *state, int ways) {
+    return (int)(NextRandom((uint64_t*)state) % (uint64_t)ways);
+}
+
+//table of the policies that can be selected with the ReplacementPolicy field
+static const ReplacementPolicy ReplacementPolicies[] = {
+    {'L', "LRU", LRUStateBytes, LRUInit, LRUTouch, LRUTouch, LRUVictim},
+    {'F', "FIFO", FIFOStateBytes, FIFOInit, FIFOHit, FIFOFill, FIFOVictim},
+    {'P', "tree-PLRU", PLRUStateBytes, PLRUInit, PLRUTouch, PLRUTouch, PLRUVictim},
+    {'S', "SRRIP", RRIPStateBytes, RRIPInit, RRIPHit, SRRIPFill, RRIPVictim},
+    {'B', "BRRIP", BRRIPStateBytes, BRRIPInit, RRIPHit, BRRIPFill, RRIPVictim},
+    {'U', "LFU", LFUStateBytes, LFUInit, LFUHit, LFUFill, LFUVictim},
+    {'R', "random", RandomStateBytes, RandomInit, RandomTouch, RandomTouch, RandomVictim},
+};
+
+/*returns the replacement policy with the given letter or NULL*/
+static const ReplacementPolicy* FindReplacementPolicy(char code) {
+    for (size_t i = 0; i < sizeof(ReplacementPolicies) / sizeof(ReplacementPolicies[0]); i++) {
+        if (ReplacementPolicies[i].Code == code) {
+            return &ReplacementPolicies[i];
+        }
+    }
+    return NULL;
+}
+
+/*returns zeroed memory that starts on a 64 byte cache line, or NULL*/
+static void* AllocateAligned(size_t bytes) {
+    void *p;
+    bytes = (bytes + 63) & ~(size_t)63;
+    if (posix_memalign(&p, 64, bytes ? bytes : 64) != 0) {
+        return NULL;
+    }
+    memset(p, 0, bytes);
+    return p;
+}
+
+/*This function allocates the empty cache and the replacement policy state on the heap*/
+static CacheState* InitializeCache(Memory *userinput, Size *BytesAndBits) {
+    CacheState *state = (CacheState*)calloc(1, sizeof(CacheState));
+    int size = userinput->CacheSize / userinput->CacheBlockSize;
     int setAssoc = userinput->SetAssoc;
-    //create array of type Cache to store the contents of each block
-    Cache initializeCache[size];
-    char s[] = "X";
-    char q[] = "?";
-    //loop populates or initializes the empty cache
-    //size variable is number of cache blocks used
-    for (int i = 0; i < size; i++) {
-        initializeCache[i].ValidBit = 0;
-        strcpy(initializeCache[i].DirtyBit, s);
-        strcpy(initializeCache[i].tag, s); 
-        strcpy(initializeCache[i].data, q);
-        initializeCache[i].blknum = i;
-        initializeCache[i].setnum = i / setAssoc;
-    }
-
-    /*LRU matrix used to hold the cache block number of the least
-    recently accessed location-upon initialization the lru for each
-    cache set is always the first block in the set*/ 
-    int LRU_matrix[size][BytesAndBits->NumCacheSets];
-    for (int st = 0; st < BytesAndBits->NumCacheSets; st++) {
-        for (int sz = 0; sz < setAssoc; sz++) {
-            LRU_matrix[st][sz] = (st * setAssoc) + sz;
-        }
-    }
-    /*table array created to store data of each line in the memory location table*/
-    MemoryLocationTable tableArray[filecontents[0].NumberofMemoryReferences];
-    int numMemRef = filecontents[0].NumberofMemoryReferences;
-
-    /*cache block number matrix to generate the set of cache blocks associated with 
-    each memory address */
-    int cacheblkNumMatrix[numMemRef][userinput->SetAssoc];
-   //loop below stores data into the main memory table struct array by calling 3 functions
-    for (int w = 0; w < filecontents[0].NumberofMemoryReferences; w++) {
-        tableArray[w].MainMemoryBlockNum = CalculateMainMemBlkNum(filecontents, BytesAndBits, userinput, w);
-        tableArray[w].CacheMemorySetNum = CalculateCacheMemSetNum(filecontents, BytesAndBits, userinput, w, tableArray);
-        tableArray[w].tag = tableArray[w].MainMemoryBlockNum / pow(2, BytesAndBits->IndexBits);
-        //for loop below used to determine the set of cache blocks associated with each memory address
-        for (int j = 0; j < userinput->SetAssoc; j++) {
-        cacheblkNumMatrix[w][j] = CalculateCacheMemBlkNum(filecontents, BytesAndBits, userinput, w, tableArray, j);
-        }
-    }
-    char repL[] = "L";
-    char repB[] = "B";
-    int SetisFull = 1;
-    int CachePos;
-    int ActualHits = 0;
-    int hitFlag = 0;
-    int k = 0;
-    int flag = 0;
-    
-    int LRU[BytesAndBits->NumCacheSets];
-    int FIFO[BytesAndBits->NumCacheSets];
-    //initializes LRU of each set to be the first block in the set
-    for (int j = 0; j < BytesAndBits->NumCacheSets; j++) {
-        LRU[j] = LRU_matrix[j][0];
-    }
-
-        for (int i = 0; i < numMemRef; i++) {//loop through number of mem references
-            for (int j = 0; j < BytesAndBits->NumCacheSets; j++) {//loop number of cache sets
-            LRU[j] = LRU_matrix[j][0];//re-initialize LRU location
-                if (tableArray[i].CacheMemorySetNum == j) { //if cache set matches mm set
-                        hitFlag = 0;
-                        SetisFull = 1;
-                        //initialize cache block number in relation to set associativity
-                        int cacheblocknumber = (j * (userinput->SetAssoc))+k;
-                        for (k = 0; k < userinput->SetAssoc; k++) {//loop blocks in the set
-                        cacheblocknumber = (j * (userinput->SetAssoc))+k;
-                        char str[100];
-                        sprintf(str, "%d", tableArray[i].tag);//convert tag to a string
-                            //if the tags match we get a cache hit 
-                            if (strcmp(str, initializeCache[cacheblocknumber].tag) == 0) { 
-                            hitFlag = 1;
-                            strcpy(tableArray[i].HitOrMiss, "Hit");
-                            strcpy(initializeCache[cacheblocknumber].tag, str);
-                            ActualHits++;//keep track of number of cache hits
-                            FIFO[j] = cacheblocknumber;//update FIFO
-                        
-                            initializeCache[cacheblocknumber].ValidBit = 1;
-                                //if memory address is a Write 
-                                if (filecontents[i].ReadOrWrite == 1) {
-                                    //if write-back policy 
-                                    if (strcmp(userinput->WritePolicy, "B") == 0) {
-                                        strcpy(initializeCache[cacheblocknumber].DirtyBit, "1");
-                                    }
-                                    //if write-through policy
-                                    else if (strcmp(userinput->WritePolicy, "T") == 0) {
-                                        strcpy(initializeCache[cacheblocknumber].DirtyBit, "X");
-                                    }
-                                }
-                                //if memory address is a Read
-                                else if (filecontents[i].ReadOrWrite == 0) {
-                                    if (strcmp(userinput->WritePolicy, "B") == 0) {
-                                        strcpy(initializeCache[cacheblocknumber].DirtyBit, "0");
-                                    }
-                                    else if (strcmp(userinput->WritePolicy, "T") == 0) {
-                                        strcpy(initializeCache[cacheblocknumber].DirtyBit, "X");
-                                    }
-                                }
-                            //this if statement handles the case where the LRU is at the bottom of the cache set and the cache is full
-                            if ((j == (BytesAndBits->NumCacheSets) - 1) || strcmp(initializeCache[(j * (userinput->SetAssoc)) + ((userinput->SetAssoc)-1)].tag, "X") != 0){
-                                //store location just accessed in temporary variable
-                                int temp = LRU_matrix[j][cacheblocknumber];
-                                //for loop shifts all other values in the LRU matrix up 
-                                for (int mov = k+1; mov < size-1; mov++) {
-                                    LRU_matrix[j][mov-1] = LRU_matrix[j][mov];
-                                    //stores the most recently used at the bottom or end of the matrix
-                                    LRU_matrix[j][size-1] = temp;
-                                }
-                                //this is so that the LRU of that set can always be found at position 0
-                                LRU[j] = LRU_matrix[j][0];
-                            }
-                            if (hitFlag)break;
-                          }
-                         if (hitFlag)break;
-                        }
-                    if (!hitFlag) {//if no cache hit and the set is not full
-                            for (k = 0; k < userinput->SetAssoc; k++) {//loop through blocks
-                                cacheblocknumber = j * (userinput->SetAssoc)+k;
-                                if (strcmp(initializeCache[cacheblocknumber].tag, "X") == 0) {
-                                    SetisFull = 0;
-                                    //fill the next available spot 
-                                    //update the FIFO
-                                    FIFO[j] = cacheblocknumber;
-                                    strcpy(tableArray[i].HitOrMiss, "Miss");
-                                    char str[100];
-                                    sprintf(str, "%d", tableArray[i].tag);
-                                    strcpy(initializeCache[cacheblocknumber].tag, str);
-                                    sprintf(initializeCache[cacheblocknumber].data, "%d", tableArray[i].MainMemoryBlockNum);
-                                    initializeCache[cacheblocknumber].ValidBit = 1;
-                                    if (filecontents[i].ReadOrWrite == 1) {
-                                        if (strcmp(userinput->WritePolicy, "B") == 0) {
-                                            strcpy(initializeCache[cacheblocknumber].DirtyBit, "1");
-                                        }
-                                        else if (strcmp(userinput->WritePolicy, "T") == 0) {
-                                            strcpy(initializeCache[cacheblocknumber].DirtyBit, "X");
-                                        }
-                                    }
-                                    else if (filecontents[i].ReadOrWrite == 0) {
-                                        if (strcmp(userinput->WritePolicy, "B") == 0) {
-                                            strcpy(initializeCache[cacheblocknumber].DirtyBit, "0");
-                                        }
-                                        else if (strcmp(userinput->WritePolicy, "T") == 0) {
-                                            strcpy(initializeCache[cacheblocknumber].DirtyBit, "X");
-                                        }
-                                    }
-                                    hitFlag = 1;
-                                    break;
-                                }
-                            }
-
-                        if (SetisFull) {//if no cache hits and the set is full
-                            flag = 1;
-                            strcpy(tableArray[i].HitOrMiss, "Miss");
-                            char str[100]; 
-                            sprintf(str, "%d", tableArray[i].tag);
-                                //if user selects LRU policy
-                                if (strcmp(userinput->ReplacementPolicy, "L") == 0) {
-                                    //the new contents get stored at the LRU position stored in the LRU array
-                                    strcpy(initializeCache[LRU[j]].tag, str);
-                                    sprintf(initializeCache[LRU[j]].data, "%d", tableArray[i].MainMemoryBlockNum);
-                                        if (filecontents[i].ReadOrWrite == 1) {
-                                            if (strcmp(userinput->WritePolicy, "B") == 0) {
-                                                strcpy(initializeCache[LRU[j]].DirtyBit, "1");
-                                            }
-                                            else if (strcmp(userinput->WritePolicy, "T") == 0) {
-                                                strcpy(initializeCache[LRU[j]].DirtyBit, "X");
-                                            }
-                                        }
-                                        else if (filecontents[i].ReadOrWrite == 0) {
-                                            if (strcmp(userinput->WritePolicy, "B") == 0) {
-                                                strcpy(initializeCache[LRU[j]].DirtyBit, "0");
-                                            }
-                                            else if (strcmp(userinput->WritePolicy, "T") == 0) {
-                                                strcpy(initializeCache[LRU[j]].DirtyBit, "X");
-                                            }
-                                        }
-                                        //for loop used to shift the contents of the LRU 
-                                        int temp = LRU_matrix[j][0];
-                                        for (int mov = 0; mov < k; mov++) {
-                                            LRU_matrix[j][mov] = LRU_matrix[j][mov+1];
-                                        }
-                                        LRU_matrix[j][k-1] = temp;
-                                        LRU[j] = LRU_matrix[j][0];   
-                                        }
-                                        //if user selects FIFO replacement policy
-                                        else if (strcmp(userinput->ReplacementPolicy, "F") == 0) {
-                                            sprintf(str, "%d", tableArray[i].tag); 
-                                            strcpy(initializeCache[FIFO[j]].tag, str);
-                                            sprintf(initializeCache[FIFO[j]].data, "%d", tableArray[i].MainMemoryBlockNum);
-                                            if (filecontents[i].ReadOrWrite == 1) {
-                                                if (strcmp(userinput->WritePolicy, "B") == 0) {
-                                                    strcpy(initializeCache[FIFO[j]].DirtyBit, "1");
-                                                }
-                                                else if (strcmp(userinput->WritePolicy, "T") == 0) {
-                                                    strcpy(initializeCache[FIFO[j]].DirtyBit, "X");
-                                                }
-                                            }
-                                            else if (filecontents[i].ReadOrWrite == 0) {
-                                                 if (strcmp(userinput->WritePolicy, "B") == 0) {
-                                                    strcpy(initializeCache[FIFO[j]].DirtyBit, "0");
-                                                }
-                                                else if (strcmp(userinput->WritePolicy, "T") == 0) {
-                                                    strcpy(initializeCache[FIFO[j]].DirtyBit, "X");
-                                                }
-                                            }
-                                            FIFO[j] = FIFO[j]; 
-                                        }
-                                    hitFlag = 1;
-                                    if (hitFlag)break;
-                        }
-                        if (hitFlag)break;
-                    }
-                }
+    state->NumCacheBlocks = size;
+    state->NumCacheSets = BytesAndBits->NumCacheSets;
+    state->FirstSet = 0;
+    state->EndSet = state->NumCacheSets;
+    state->SetAssoc = setAssoc;
+    state->BlockSize = userinput->CacheBlockSize;
+    state->WordSize = userinput->WordSize;
+    state->WriteBack = strcmp(userinput->WritePolicy, "B") == 0;
+    state->WriteThrough = strcmp(userinput->WritePolicy, "T") == 0;
+    if (setAssoc > 65535) {
+        printf("AT MOST 65535 WAYS ARE SUPPORTED\n");
+        free(state);
+        return NULL;
+    }
+    state->Policy = FindReplacementPolicy(userinput->ReplacementPolicy[0]);
+    if (!state->Policy) {
+        printf("UNKNOWN REPLACEMENT POLICY %s\n", userinput->ReplacementPolicy);
+        free(state);
+        return NULL;
+    }
+    //the lines of a set are padded to a whole cache line so every set starts 64 byte
+    //aligned and the probe never reads past the end of a set, the padding is never valid
+    state->LineStride = (setAssoc + 7) & ~7;
+    state->lines = (uint64_t*)AllocateAligned(sizeof(uint64_t) * state->LineStride * (size_t)state->NumCacheSets);
+    if (!state->lines) {
+        printf("NOT ENOUGH MEMORY FOR THE CACHE\n");
+        free(state);
+        return NULL;
+    }
+    state->SetCounters = (CacheCounters*)calloc(state->NumCacheSets, sizeof(CacheCounters));
+    //replacement state of each set, rounded up so every set starts 8 byte aligned
+    state->ReplacementStride = (state->Policy->StateBytes(setAssoc) + 7) & ~(size_t)7;
+    state->ReplacementState = (unsigned char*)AllocateAligned(state->ReplacementStride * state->NumCacheSets + 1);
+    for (int st = 0; st < state->NumCacheSets; st++) {
+        state->Policy->Init(&state->ReplacementState[st * state->ReplacementStride], setAssoc, st);
+    }
+    int blockSize = state->BlockSize;
+    int sets = state->NumCacheSets;
+    state->PowerOfTwo = (blockSize & (blockSize - 1)) == 0 && (sets & (sets - 1)) == 0;
+    state->BlockShift = FloorLog2(blockSize);
+    state->SetShift = FloorLog2(sets);
+    state->SetMask = (uint64_t)sets - 1;
+    SelectSimulationKernel(state);
+    return state;
+}
+
+/*adds the counters of a shard of the cache to the counters of the whole cache*/
+static void MergeCacheCounters(CacheState *into, CacheState *from) {
+    into->ActualHits += from->ActualHits;
+    into->NumberofMemoryReferences += from->NumberofMemoryReferences;
+    AddCacheCounters(&into->Counters, &from->Counters);
+}
+
+/*frees everything allocated by InitializeCache*/
+static void FreeCache(CacheState *state) {
+    free(state->SetCounters);
+    free(state->SampledSets);
+    free(state->lines);
+    free(state->ReplacementState);
+    free(state);
+}
+
+/*This function compares tag against every way of a set and returns the way that
+holds it or -1, and stores the first invalid way (or -1 if the set is full) in empty.
+Four (AVX2) or two (SSE2) lines are compared per instruction, the dirty and
+prefetched bits are masked off so a line matches whatever their values*/
+static inline int ProbeSet(const uint64_t *lines, int ways, uint64_t tag, int *empty) {
+    uint64_t key = LINE_VALID | tag;
+    *empty = -1;
+#if defined(__AVX2__)
+    __m256i keys = _mm256_set1_epi64x((long long)key);
+    __m256i ignore = _mm256_set1_epi64x((long long)(LINE_DIRTY | LINE_PREFETCHED));
+    __m256i validbit = _mm256_set1_epi64x((long long)LINE_VALID);
+    for (int w = 0; w < ways; w += 4) {
+        __m256i line = _mm256_load_si256((const __m256i*)(lines + w));
+        unsigned match = (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_andnot_si256(ignore, line), keys)));
+        if (match) {
+            return w + __builtin_ctz(match);
+        }
+        if (*empty < 0) {
+            unsigned invalid = (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(line, validbit), _mm256_setzero_si256())));
+            if (invalid && w + __builtin_ctz(invalid) < ways) {
+                *empty = w + __builtin_ctz(invalid);
             }
         }
-//printing main memory location table
-printf("\nmain memory address\tmm blk#\t\t   cm set#\t    cm blk#\t     hit/miss\n");
-printf("______________________________________________________________________________________\n");
-for (int i = 0; i < filecontents[0].NumberofMemoryReferences; i++) {
-    printf("  %d\t\t\t", filecontents[i].Address);
-    printf("  %d\t\t    ", tableArray[i].MainMemoryBlockNum);
-    printf("  %d\t\t    ", tableArray[i].CacheMemorySetNum);
-    if (userinput->SetAssoc == 1) {
-        printf("  %d\t\t", cacheblkNumMatrix[i][0]);
     }
-    else {
-        printf("  %d-%d\t\t", cacheblkNumMatrix[i][0], cacheblkNumMatrix[i][(userinput->SetAssoc)-1]);
-    }
-    printf("%s\n", tableArray[i].HitOrMiss);    
-}
-//printing final status of the cache
-printf("\nFINAL STATUS OF THE CACHE:\n");
-printf("Cache blk#\tdirty bit\tvalid bit\ttag\t\tData\n");
-printf("______________________________________________________________________________________\n");
-for (int i = 0; i < size; i++) {
-        printf(" %d\t\t", initializeCache[i].blknum);
-        printf(" %s\t\t", initializeCache[i].DirtyBit);
-        printf(" %d\t\t", initializeCache[i].ValidBit);
-        if (strcmp(initializeCache[i].tag, "X") == 0) {
-            for (int t = 0; t < BytesAndBits->TagBits; t++) {
-                printf("X");
-            }
-        }
-        else {//convert tag to binary
-            int num = atoi(initializeCache[i].tag);
-            int rem;
-            int bin[BytesAndBits->TagBits];
-            for (int t = BytesAndBits->TagBits; t > 0; t--) {
-                rem = num % 2;
-                bin[t-1] = rem;
-                num = num / 2;
-            }
-            for (int t = 0; t < BytesAndBits->TagBits; t++) {
-                printf("%d", bin[t]);
-            }
-        }
-        printf("\t\tmm blk #%s\n", initializeCache[i].data);   
-    }
-
-printf("\n");
-//print actual cache hit rate
-printf("Actual Hit Rate = %d/%d = %.2f%%\n", ActualHits, numMemRef, (float)100*ActualHits/numMemRef);
-
-int refsize = filecontents[0].NumberofMemoryReferences;
-//calculates best possible hit rate
-CalculateBestPossibleHitRate(tableArray, refsize);
-
-    /*return table;*/
-} 
-
-/* this function will  be called by the CreateMemLocTable function and calculate mm blk#*/
-int CalculateMainMemBlkNum(FileContents *filecontents, Size *BytesAndBits, Memory *userinput, int i) {
-    int blocknum = filecontents[i].Address / userinput->CacheBlockSize;
-    return blocknum;
-}
-
-/* this function will  be called by the CreateMemLocTable function and calculate cm blk#*/
-int CalculateCacheMemBlkNum(FileContents *filecontents, Size *BytesAndBits, Memory *userinput, int i, MemoryLocationTable *tableArray, int j) {
-    int blknum = filecontents[i].Address / userinput->CacheBlockSize;
-    int cache =  userinput->CacheSize / userinput->CacheBlockSize;
-    int num = blknum % cache;
-    int possiblecacheblocknums[userinput->CacheBlockSize][userinput->SetAssoc];
-    int blkmatrix[userinput->SetAssoc];
-    int totalCacheSets = (userinput->CacheSize / userinput->CacheBlockSize) / userinput->SetAssoc;
-    int k = 0;
-    for (int w = 0; w < totalCacheSets; w++) {
-        for (int p = 0; p < userinput->SetAssoc; p++) {
-            blkmatrix[p] = k;
-            possiblecacheblocknums[w][p] = blkmatrix[p];
-            k++;
-        }
-    }
-    //returns one block number at a time associated with each cache set 
-    //this is because this function is called from inside a loop 
-    int CacheSetNum = (tableArray[i].MainMemoryBlockNum) % totalCacheSets;
-    return possiblecacheblocknums[CacheSetNum][j];
-}
-
-/* this function will  be called by the CreateMemLocTable function and calculate cm set#*/
-int CalculateCacheMemSetNum(FileContents *filecontents, Size *BytesAndBits, Memory *userinput, int i, MemoryLocationTable *tableArray) {
-    int numCacheBlocksPerSet = userinput->SetAssoc;
-    int totalCacheSets = (userinput->CacheSize / userinput->CacheBlockSize) / numCacheBlocksPerSet; 
-    int CacheSetNum = tableArray[i].MainMemoryBlockNum % totalCacheSets; 
-    return CacheSetNum;
-}
-
-/*  this function will calculate and the best possible hit rate*/
-void CalculateBestPossibleHitRate(MemoryLocationTable *tableArray, int size) {
-    int hits[size];
-    int hit = 0;
-    for (int i = 0; i < size; i++) {
-        int element = tableArray[i].MainMemoryBlockNum;
-        int flag = 0;
-        for (int j = i+1; j < size; j++) {
-            //compares each block in main memory to the blocks below and counts 
-            //the number of repeats 
-            if (tableArray[i].MainMemoryBlockNum == tableArray[j].MainMemoryBlockNum) {
-                flag = 1;
-                hit++;
-                hits[hit] = element;
-                break;
+    return -1;
+#elif defined(__SSE2__)
+    //SSE2 has no 64 bit compare, a line matches when both of its 32 bit halves do
+    __m128i keys = _mm_set1_epi64x((long long)key);
+    __m128i ignore = _mm_set1_epi64x((long long)(LINE_DIRTY | LINE_PREFETCHED));
+    for (int w = 0; w < ways; w += 2) {
+        __m128i line = _mm_load_si128((const __m128i*)(lines + w));
+        unsigned bytes = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_andnot_si128(ignore, line), keys));
+        unsigned match = ((bytes & 0xff) == 0xff) | (((bytes >> 8) == 0xff) << 1);
+        if (match) {
+            return w + __builtin_ctz(match);
+        }
+        if (*empty < 0) {
+            if (!(lines[w] & LINE_VALID)) {
+                *empty = w;
+            }
+            else if (w + 1 < ways && !(lines[w + 1] & LINE_VALID)) {
+                *empty = w + 1;
             }
         }
-            if (flag) {
-                continue;
-            }   
     }
-    printf("\n");
-    float hitfloat = hit * 1.00;
-    float sizefloat = size * 1.00;
-    float hitrate = (hitfloat/sizefloat) * 100.00;
-    printf("Best possible hit rate = %d/%d = %.2f%%\n", hit, size, hitrate);
-    //return;
+    return -1;
+#else
+    for (int w = 0; w < ways; w++) {
+        if ((lines[w] & ~(LINE_DIRTY | LINE_PREFETCHED)) == key) {
+            return w;
+        }
+        if (*empty < 0 && !(lines[w] & LINE_VALID)) {
+            *empty = w;
+        }
+    }
+    return -1;
+#endif
 }
 
-int main () {
+/*allocates a prefetcher of the given kind (PREFETCH_NEXT_LINE, PREFETCH_STRIDE or
+PREFETCH_STREAM) for the cache and attaches it, degree blocks are fetched each time it
+triggers starting distance blocks ahead of the reference*/
+static Prefetcher* NewPrefetcher(CacheState *state, Memory *userinput, int kind, int degree, int distance) {
+    Prefetcher *pf = (Prefetcher*)calloc(1, sizeof(Prefetcher));
+    pf->Kind = kind;
+    pf->Degree = degree;
+    pf->Distance = distance;
+    pf->HitLatency = userinput->HitLatency;
+    pf->MissPenalty = userinput->MissPenalty;
+    pf->NumMemoryBlocks = (uint64_t)(userinput->MainMemorySize / userinput->CacheBlockSize);
+    pf->Ready = (long long*)calloc((size_t)state->LineStride * state->NumCacheSets, sizeof(long long));
+    //at least four bits per cache block keeps false pollution hits rare
+    pf->EvictedBits = 12;
+    while ((1LL << pf->EvictedBits) < 4LL * state->NumCacheBlocks) {
+        pf->EvictedBits++;
+    }
+    pf->Evicted = (uint64_t*)calloc(((size_t)1 << pf->EvictedBits) / 64, sizeof(uint64_t));
+    state->Prefetch = pf;
+    SelectSimulationKernel(state);
+    return pf;
+}
 
+static void FreePrefetcher(Prefetcher *pf) {
+    free(pf->Ready);
+    free(pf->Evicted);
+    free(pf);
+}
+
+//bit of the pollution filter for a block
+static inline uint64_t* EvictedWord(Prefetcher *pf, uint64_t block, uint64_t *bit) {
+    uint64_t h = (block * 0x9e3779b97f4a7c15ULL) >> (64 - pf->EvictedBits);
+    *bit = (uint64_t)1 << (h & 63);
+    return &pf->Evicted[h >> 6];
+}
+
+/*This function fetches a block into the cache ahead of demand, unless it is already
+there. The victim is chosen by the replacement policy as for a demand miss, a victim
+that was prefetched and never used is counted as useless and any other valid victim
+goes into the pollution filter*/
+static void PrefetchBlock(CacheState *state, uint64_t block) {
+    Prefetcher *pf = state->Prefetch;
+    int j = (int)(block % (uint64_t)state->NumCacheSets);
+    uint64_t tag = (block / (uint64_t)state->NumCacheSets) & LINE_TAG_MASK;
+    size_t first = (size_t)j * state->LineStride;
+    uint64_t *lines = &state->lines[first];
+    unsigned char *replacement = &state->ReplacementState[(size_t)j * state->ReplacementStride];
+    int empty;
+    if (ProbeSet(lines, state->SetAssoc, tag, &empty) >= 0) {
+        pf->Redundant++;
+        return;
+    }
+    int k = empty;
+    if (k < 0) {
+        k = state->Policy->Victim(replacement, state->SetAssoc);
+        if (lines[k] & LINE_DIRTY) {
+            state->Counters.DirtyEvictions++;
+            state->Counters.WritebackBytes += state->BlockSize;
+            state->SetCounters[j].DirtyEvictions++;
+            state->SetCounters[j].WritebackBytes += state->BlockSize;
+        }
+        if (lines[k] & LINE_PREFETCHED) {
+            pf->Useless++;
+        }
+        else {
+            uint64_t bit;
+            *EvictedWord(pf, (lines[k] & LINE_TAG_MASK) * (uint64_t)state->NumCacheSets + j, &bit) |= bit;
+        }
+    }
+    uint64_t bit;
+    *EvictedWord(pf, block, &bit) &= ~bit;//back in the cache, a later miss on it is not pollution
+    state->Counters.FillBytes += state->BlockSize;
+    state->SetCounters[j].FillBytes += state->BlockSize;
+    lines[k] = LINE_VALID | LINE_PREFETCHED | tag;
+    state->Policy->Fill(replacement, state->SetAssoc, k);
+    pf->Ready[first + k] = pf->Clock + pf->MissPenalty;
+    pf->Issued++;
+}
+
+//prefetches Degree blocks starting Distance strides from block, staying inside main memory
+static void PrefetchAhead(CacheState *state, uint64_t block, long long stride) {
+    Prefetcher *pf = state->Prefetch;
+    for (int i = 0; i < pf->Degree; i++) {
+        long long offset = stride * (pf->Distance + i);
+        if ((offset < 0 && (uint64_t)-offset > block) || block + (uint64_t)offset >= pf->NumMemoryBlocks) {
+            return;
+        }
+        PrefetchBlock(state, block + (uint64_t)offset);
+    }
+}
+
+/*This function shows one demand reference to the prefetcher. trigger is set on a
+demand miss and on the first demand reference to a prefetched line.
+  next-line: on a trigger, fetch the blocks after the referenced one.
+  stride: every reference updates the reference prediction table entry of its
+          RPT_REGION_BITS sized region of memory with the distance from the last
+          block referenced there; once the same stride has been seen twice the
+          blocks one or more strides ahead are fetched.
+  stream: a trigger within STREAM_WINDOW blocks of a tracked stream moves it, two
+          moves in the same direction confirm it and fetch ahead in that direction,
+          a trigger near no stream replaces the least recently used one*/
+static void RunPrefetcher(CacheState *state, uint64_t block, int trigger) {
+    Prefetcher *pf = state->Prefetch;
+    if (pf->Kind == PREFETCH_NEXT_LINE) {
+        if (trigger) {
+            PrefetchAhead(state, block, 1);
+        }
+    }
+    else if (pf->Kind == PREFETCH_STRIDE) {
+        uint64_t region = block * (uint64_t)state->BlockSize >> RPT_REGION_BITS;
+        RptEntry *e = &pf->Table[(region * 0x9e3779b97f4a7c15ULL) >> (64 - RPT_INDEX_BITS)];
+        if (!e->Valid || e->Region != region) {
+            e->Valid = 1;
+            e->Region = region;
+            e->LastBlock = block;
+            e->Stride = 0;
+            e->Confidence = 0;
+            return;
+        }
+        long long stride = (long long)(block - e->LastBlock);
+        if (stride == 0) {
+            return;
+        }
+        if (stride == e->Stride) {
+            if (e->Confidence < 3) {
+                e->Confidence++;
+            }
+        }
+        else if (e->Confidence > 0) {
+            e->Confidence--;
+        }
+        else {
+            e->Stride = stride;
+        }
+        e->LastBlock = block;
+        //a stride is adopted the first time it is seen and confirmed the second time
+        if (e->Confidence >= 1) {
+            PrefetchAhead(state, block, e->Stride);
+        }
+    }
+    else if (trigger) {
+        StreamTracker *s = NULL;
+        StreamTracker *oldest = &pf->Streams[0];
+        for (int i = 0; i < STREAM_TRACKERS; i++) {
+            StreamTracker *t = &pf->Streams[i];
+            if (t->LastUse > 0 && block != t->LastBlock &&
+                (block > t->LastBlock ? block - t->LastBlock : t->LastBlock - block) <= STREAM_WINDOW) {
+                s = t;
+                break;
+            }
+            if (t->LastUse < oldest->LastUse) {
+                oldest = t;
+            }
+        }
+        if (!s) {
+            oldest->LastBlock = block;
+            oldest->Direction = 0;
+            oldest->Confirmations = 0;
+            oldest->LastUse = state->NumberofMemoryReferences;
+            return;
+        }
+        int direction = block > s->LastBlock ? 1 : -1;
+        if (direction == s->Direction) {
+            s->Confirmations++;
+        }
+        else {
+            s->Direction = direction;
+            s->Confirmations = 1;
+        }
+        s->LastBlock = block;
+        s->LastUse = state->NumberofMemoryReferences;
+        if (s->Confirmations >= 2) {
+            PrefetchAhead(state, block, direction);
+        }
+    }
+}
+
+static const char *PrefetcherNames[] = {"", "next-line", "stride", "stream"};
+
+/*prints how many prefetches were issued and their accuracy, coverage, timeliness and pollution*/
+static void PrintPrefetchCounters(CacheState *state) {
+    Prefetcher *pf = state->Prefetch;
+    long long misses = state->NumberofMemoryReferences - state->ActualHits;
+    long long unused = 0;
+    for (size_t i = 0; i < (size_t)state->LineStride * state->NumCacheSets; i++) {
+        unused += (state->lines[i] & (LINE_VALID | LINE_PREFETCHED)) == (LINE_VALID | LINE_PREFETCHED);
+    }
+    printf("\nPREFETCHER (%s, degree %d, distance %d):\n", PrefetcherNames[pf->Kind], pf->Degree, pf->Distance);
+    printf("Prefetches issued = %lld (%lld bytes), %lld more were already in the cache\n",
+           pf->Issued, pf->Issued * state->BlockSize, pf->Redundant);
+    printf("Useful = %lld, evicted unused = %lld, still unused in the cache = %lld\n", pf->Useful, pf->Useless, unused);
+    printf("Accuracy = %.2f%% of the prefetches were used\n", pf->Issued ? 100.0 * pf->Useful / pf->Issued : 0.0);
+    printf("Coverage = %.2f%% of the misses were removed\n", pf->Useful + misses ? 100.0 * pf->Useful / (pf->Useful + misses) : 0.0);
+    printf("Timeliness = %.2f%% of the useful prefetches arrived in time, %lld were late by %.1f cycles on average\n",
+           pf->Useful ? 100.0 * (pf->Useful - pf->Late) / pf->Useful : 0.0, pf->Late, pf->Late ? (double)pf->LateCycles / pf->Late : 0.0);
+    printf("Pollution = %lld misses on blocks evicted by prefetches (%.2f%% of the misses)\n",
+           pf->PollutionMisses, misses ? 100.0 * pf->PollutionMisses / misses : 0.0);
+    printf("Average memory access time waiting for late prefetches = %.2f cycles\n",
+           state->NumberofMemoryReferences ? (double)pf->Clock / state->NumberofMemoryReferences : 0.0);
+}
+
+/*splits an address into its main memory block, which is returned, and its set and
+tag, with shifts and a mask when the block size and the number of sets are powers of two*/
+static inline uint64_t DecomposeAddress(CacheState *state, uint64_t address, int *set, uint64_t *tag) {
+    uint64_t block;
+    if (state->PowerOfTwo) {
+        block = address >> state->BlockShift;
+        *set = (int)(block & state->SetMask);
+        *tag = block >> state->SetShift;
+    }
+    else {
+        block = address / (uint64_t)state->BlockSize;
+        *set = (int)(block % (uint64_t)state->NumCacheSets);
+        *tag = block / (uint64_t)state->NumCacheSets;
+    }
+    return block;
+}
+
+//false for a set that belongs to another shard or is not sampled
+static inline int SimulatesSet(CacheState *state, int j) {
+    return j >= state->FirstSet && j < state->EndSet && !(state->SampleOnly && !state->SampledSets[j]);
+}
+
+/*This function runs one reference to block through set j of the cache and returns 1
+on a hit or 0 on a miss. Write-back caches mark written blocks dirty and write them
+back when they are evicted, write-through caches send every write to memory and never
+hold dirty blocks, both allocate on a write miss. It is always inlined, so each
+kernel below gets its own copy with the associativity and policy as constants*/
+static inline __attribute__((always_inline)) int AccessCacheSet(CacheState *state, int j, uint64_t block, uint64_t tag, int write,
+                                                                const int setAssoc, const ReplacementPolicy *policy, Prefetcher *pf) {
+    state->NumberofMemoryReferences++;
+    uint64_t *lines = &state->lines[(size_t)j * state->LineStride];
+    unsigned char *replacement = &state->ReplacementState[(size_t)j * state->ReplacementStride];
+    CacheCounters *setcounters = &state->SetCounters[j];
+    if (write && state->WriteThrough) {
+        state->Counters.WriteThroughBytes += state->WordSize;
+    }
+
+    int empty;
+    int k = ProbeSet(lines, setAssoc, tag, &empty);
+    //if the tags match we get a cache hit
+    if (k >= 0) {
+        state->ActualHits++;//keep track of number of cache hits
+        int prefetched = (lines[k] & LINE_PREFETCHED) != 0;
+        if (pf) {
+            pf->Clock += pf->HitLatency;
+            //the first use of a prefetched line, which waits if the prefetch has not arrived yet
+            if (prefetched) {
+                long long ready = pf->Ready[(size_t)j * state->LineStride + k];
+                lines[k] &= ~LINE_PREFETCHED;
+                pf->Useful++;
+                if (pf->Clock < ready) {
+                    pf->Late++;
+                    pf->LateCycles += ready - pf->Clock;
+                    pf->Clock = ready;
+                }
+            }
+        }
+        if (write) {
+            state->Counters.WriteHits++;
+            setcounters->WriteHits++;
+            if (state->WriteBack) {
+                lines[k] |= LINE_DIRTY;
+            }
+        }
+        else {
+            state->Counters.ReadHits++;
+            setcounters->ReadHits++;
+        }
+        policy->Hit(replacement, setAssoc, k);
+        if (pf) {
+            RunPrefetcher(state, block, prefetched);
+        }
+        return 1;
+    }
+    if (pf) {
+        uint64_t bit;
+        uint64_t *word = EvictedWord(pf, block, &bit);
+        if (*word & bit) {
+            pf->PollutionMisses++;
+            *word &= ~bit;
+        }
+        pf->Clock += pf->HitLatency + pf->MissPenalty;
+    }
+    if (write) {
+        state->Counters.WriteMisses++;
+        setcounters->WriteMisses++;
+    }
+    else {
+        state->Counters.ReadMisses++;
+        setcounters->ReadMisses++;
+    }
+    //fill the first empty block of the set, or replace the block the policy picks if the set is full
+    k = empty;
+    if (k < 0) {
+        k = policy->Victim(replacement, setAssoc);
+        //a dirty victim has to be written back before it is replaced
+        if (lines[k] & LINE_DIRTY) {
+            state->Counters.DirtyEvictions++;
+            state->Counters.WritebackBytes += state->BlockSize;
+            setcounters->DirtyEvictions++;
+            setcounters->WritebackBytes += state->BlockSize;
+        }
+        if (pf && (lines[k] & LINE_PREFETCHED)) {
+            pf->Useless++;
+        }
+    }
+    state->Counters.FillBytes += state->BlockSize;
+    setcounters->FillBytes += state->BlockSize;
+    lines[k] = LINE_VALID | tag | (write && state->WriteBack ? LINE_DIRTY : 0);
+    policy->Fill(replacement, setAssoc, k);
+    if (pf) {
+        RunPrefetcher(state, block, 1);
+    }
+    return 0;
+}
+
+/*This function runs a single memory reference through the cache and fills in
+its row of the main memory table*/
+static void SimulateReference(CacheState *state, FileContents *ref, Memory *userinput, Size *BytesAndBits, MemoryLocationTable *row) {
+    //the set number indexes the set's lines and replacement state directly
+    int j;
+    row->MainMemoryBlockNum = DecomposeAddress(state, ref->Address, &j, &row->tag);
+    row->CacheMemorySetNum = j;
+    row->CacheMemoryBlockNum = CalculateCacheMemBlkNum(row, BytesAndBits, userinput, 0);
+    if (!SimulatesSet(state, j)) {
+        row->Hit = -1;
+        return;
+    }
+    row->Hit = AccessCacheSet(state, j, row->MainMemoryBlockNum, row->tag & LINE_TAG_MASK, ref->ReadOrWrite == 1,
+                              state->SetAssoc, state->Policy, state->Prefetch);
+}
+
+/*the generic kernel: any geometry, any policy and the prefetchers*/
+static void SimulateKernelGeneric(CacheState *state, FileContents *refs, int n) {
+    for (int i = 0; i < n; i++) {
+        int j;
+        uint64_t tag;
+        uint64_t block = DecomposeAddress(state, refs[i].Address, &j, &tag);
+        if (SimulatesSet(state, j)) {
+            AccessCacheSet(state, j, block, tag & LINE_TAG_MASK, refs[i].ReadOrWrite == 1, state->SetAssoc, state->Policy, state->Prefetch);
+        }
+    }
+}
+
+#ifndef GENERIC_KERNEL_ONLY
+/*the body of the specialized kernels: the block size and number of sets are powers of
+two, ways and policy are compile time constants (policy points into ReplacementPolicies)
+so the probe loop is unrolled and the policy calls are direct and inlined*/
+static inline __attribute__((always_inline)) void SimulateKernelWith(CacheState *state, FileContents *refs, int n,
+                                                                     const int ways, const ReplacementPolicy *policy) {
+    int blockShift = state->BlockShift;
+    int setShift = state->SetShift;
+    uint64_t setMask = state->SetMask;
+    for (int i = 0; i < n; i++) {
+        uint64_t block = refs[i].Address >> blockShift;
+        int j = (int)(block & setMask);
+        if (SimulatesSet(state, j)) {
+            AccessCacheSet(state, j, block, (block >> setShift) & LINE_TAG_MASK, refs[i].ReadOrWrite == 1, ways, policy, NULL);
+        }
+    }
+}
+
+//one kernel per associativity in KERNEL_WAYS for the policy at index p of ReplacementPolicies
+#define SIMULATION_KERNELS(p) \
+    static void SimulateKernel##p##_1(CacheState *state, FileContents *refs, int n) { SimulateKernelWith(state, refs, n, 1, &ReplacementPolicies[p]); } \
+    static void SimulateKernel##p##_2(CacheState *state, FileContents *refs, int n) { SimulateKernelWith(state, refs, n, 2, &ReplacementPolicies[p]); } \
+    static void SimulateKernel##p##_4(CacheState *state, FileContents *refs, int n) { SimulateKernelWith(state, refs, n, 4, &ReplacementPolicies[p]); } \
+    static void SimulateKernel##p##_8(CacheState *state, FileContents *refs, int n) { SimulateKernelWith(state, refs, n, 8, &ReplacementPolicies[p]); } \
+    static void SimulateKernel##p##_16(CacheState *state, FileContents *refs, int n) { SimulateKernelWith(state, refs, n, 16, &ReplacementPolicies[p]); }
+#define SIMULATION_KERNEL_ROW(p) \
+    {SimulateKernel##p##_1, SimulateKernel##p##_2, SimulateKernel##p##_4, SimulateKernel##p##_8, SimulateKernel##p##_16}
+SIMULATION_KERNELS(0)
+SIMULATION_KERNELS(1)
+SIMULATION_KERNELS(2)
+SIMULATION_KERNELS(3)
+SIMULATION_KERNELS(4)
+SIMULATION_KERNELS(5)
+SIMULATION_KERNELS(6)
+//indexed by the policy's position in ReplacementPolicies and log2 of the associativity
+static const SimulationKernel SimulationKernels[][KERNEL_WAYS] = {
+    SIMULATION_KERNEL_ROW(0), SIMULATION_KERNEL_ROW(1), SIMULATION_KERNEL_ROW(2), SIMULATION_KERNEL_ROW(3),
+    SIMULATION_KERNEL_ROW(4), SIMULATION_KERNEL_ROW(5), SIMULATION_KERNEL_ROW(6),
+};
+#endif
+
+/*This function picks the kernel SimulateReferences runs: a specialized one when the
+block size and the number of sets are powers of two, the associativity is one of
+1, 2, 4, 8 or 16 and no prefetcher is attached, otherwise the generic one. Building
+with -DGENERIC_KERNEL_ONLY always picks the generic kernel, to compare the two*/
+static void SelectSimulationKernel(CacheState *state) {
+    state->Kernel = SimulateKernelGeneric;
+#ifndef GENERIC_KERNEL_ONLY
+    int ways = state->SetAssoc;
+    int log2ways = FloorLog2(ways);
+    if (state->PowerOfTwo && !state->Prefetch && (ways & (ways - 1)) == 0 && log2ways < KERNEL_WAYS) {
+        state->Kernel = SimulationKernels[state->Policy - ReplacementPolicies][log2ways];
+    }
+#endif
+}
+
+/*runs n memory references through the cache without filling in table rows*/
+static void SimulateReferences(CacheState *state, FileContents *refs, int n) {
+    state->Kernel(state, refs, n);
+}
+
+/*adds every counter in from to into*/
+static void AddCacheCounters(CacheCounters *into, CacheCounters *from) {
+    into->ReadHits += from->ReadHits;
+    into->ReadMisses += from->ReadMisses;
+    into->WriteHits += from->WriteHits;
+    into->WriteMisses += from->WriteMisses;
+    into->DirtyEvictions += from->DirtyEvictions;
+    into->WritebackBytes += from->WritebackBytes;
+    into->WriteThroughBytes += from->WriteThroughBytes;
+    into->FillBytes += from->FillBytes;
+}
+
+/*returns the number of dirty blocks still in the cache*/
+static long long CountDirtyBlocks(CacheState *state) {
+    long long count = 0;
+    for (size_t i = 0; i < (size_t)state->LineStride * state->NumCacheSets; i++) {
+        count += (state->lines[i] & (LINE_VALID | LINE_DIRTY)) == (LINE_VALID | LINE_DIRTY);
+    }
+    if (state->SampleOnly) {//only the sampled sets hold anything
+        count = (long long)((double)count * state->NumCacheSets / state->NumSampledSets + 0.5);
+    }
+    return count;
+}
+
+/*returns the average memory access time in cycles: hit time + miss rate * miss penalty*/
+static double AverageMemoryAccessTime(Memory *userinput, long long hits, long long references) {
+    double missrate = references ? (double)(references - hits) / references : 0.0;
+    return userinput->HitLatency + missrate * userinput->MissPenalty;
+}
+
+/*prints the read/write, eviction and memory traffic counters and the average memory access time*/
+static void PrintCacheCounters(CacheState *state, Memory *userinput) {
+    CacheCounters *c = &state->Counters;
+    long long traffic = c->FillBytes + c->WritebackBytes + c->WriteThroughBytes;
+    printf("Reads: %lld hits, %lld misses\n", c->ReadHits, c->ReadMisses);
+    printf("Writes: %lld hits, %lld misses\n", c->WriteHits, c->WriteMisses);
+    printf("Dirty evictions = %lld, dirty blocks left in the cache = %lld\n", c->DirtyEvictions, CountDirtyBlocks(state));
+    printf("Memory traffic = %lld bytes (fills %lld, write-backs %lld, write-through %lld)\n",
+           traffic, c->FillBytes, c->WritebackBytes, c->WriteThroughBytes);
+    printf("Average memory access time = %d + %.4f * %d = %.2f cycles\n", userinput->HitLatency,
+           state->NumberofMemoryReferences ? (double)(state->NumberofMemoryReferences - state->ActualHits) / state->NumberofMemoryReferences : 0.0,
+           userinput->MissPenalty, AverageMemoryAccessTime(userinput, state->ActualHits, state->NumberofMemoryReferences));
+}
+
+/*This function picks round(fraction * sets) sets of the cache at random (always the
+same ones for the same cache) to be simulated by set sampling*/
+static void SelectSampledSets(CacheState *state, double fraction) {
+    int sets = state->NumCacheSets;
+    int count = (int)(fraction * sets + 0.5);
+    if (count < 1) {
+        count = 1;
+    }
+    if (count > sets) {
+        count = sets;
+    }
+    //the first count entries of a partial Fisher-Yates shuffle
+    int *order = (int*)malloc(sizeof(int) * sets);
+    for (int i = 0; i < sets; i++) {
+        order[i] = i;
+    }
+    uint64_t rng = SeedRandom(sets);
+    state->SampledSets = (unsigned char*)calloc(sets, 1);
+    for (int i = 0; i < count; i++) {
+        int pick = i + (int)(NextRandom(&rng) % (uint64_t)(sets - i));
+        int t = order[i];
+        order[i] = order[pick];
+        order[pick] = t;
+        state->SampledSets[order[i]] = 1;
+    }
+    state->NumSampledSets = count;
+    free(order);
+}
+
+/*This function estimates the hit rate and dirty evictions of the whole cache from the
+per set counters of the sampled sets. Each set is one cluster of references, so the
+hit rate is the ratio estimate sum(hits) / sum(references) over the sampled sets and
+its standard error is
+  sqrt((1 - n/N) / n * sum((hits_i - R * references_i)^2) / (n - 1)) / mean(references_i)
+for n sampled sets out of N, the dirty evictions per reference are estimated the same way*/
+static SampleEstimate EstimateFromSampledSets(CacheState *state, long long totalReferences) {
+    SampleEstimate est;
+    memset(&est, 0, sizeof(est));
+    est.Sets = state->NumCacheSets;
+    est.SampledSets = state->NumSampledSets;
+    est.TotalReferences = totalReferences;
+    for (int j = 0; j < state->NumCacheSets; j++) {
+        if (!state->SampledSets[j]) {
+            continue;
+        }
+        CacheCounters *c = &state->SetCounters[j];
+        AddCacheCounters(&est.Counters, c);
+        est.Hits += c->ReadHits + c->WriteHits;
+        est.SampledReferences += c->ReadHits + c->ReadMisses + c->WriteHits + c->WriteMisses;
+    }
+    int n = est.SampledSets;
+    if (est.SampledReferences == 0) {
+        return est;
+    }
+    est.HitRate = (double)est.Hits / est.SampledReferences;
+    est.EvictionRate = (double)est.Counters.DirtyEvictions / est.SampledReferences;
+    if (n < 2) {//no spread to measure with a single set
+        est.HitRateMargin = -1;
+        est.EvictionRateMargin = -1;
+        return est;
+    }
+    double hitsum = 0, evictsum = 0;
+    for (int j = 0; j < state->NumCacheSets; j++) {
+        if (!state->SampledSets[j]) {
+            continue;
+        }
+        CacheCounters *c = &state->SetCounters[j];
+        double refs = (double)(c->ReadHits + c->ReadMisses + c->WriteHits + c->WriteMisses);
+        double hitresidual = (c->ReadHits + c->WriteHits) - est.HitRate * refs;
+        double evictresidual = c->DirtyEvictions - est.EvictionRate * refs;
+        hitsum += hitresidual * hitresidual;
+        evictsum += evictresidual * evictresidual;
+    }
+    double meanrefs = (double)est.SampledReferences / n;
+    double correction = (1.0 - (double)n / est.Sets) / n;
+    est.HitRateMargin = SAMPLE_Z * sqrt(correction * hitsum / (n - 1)) / meanrefs;
+    est.EvictionRateMargin = SAMPLE_Z * sqrt(correction * evictsum / (n - 1)) / meanrefs;
+    return est;
+}
+
+/*replaces the counters of a cache that only simulated its sampled sets with their
+estimates for the whole cache, every counter is scaled by references per sampled reference*/
+static void ExtrapolateSampledCounters(CacheState *state, SampleEstimate *est) {
+    double scale = est->SampledReferences ? (double)est->TotalReferences / est->SampledReferences : 0.0;
+    long long *counters = (long long*)&state->Counters;
+    for (size_t i = 0; i < sizeof(CacheCounters) / sizeof(long long); i++) {
+        counters[i] = llround(counters[i] * scale);
+    }
+    state->NumberofMemoryReferences = est->TotalReferences;
+    state->ActualHits = llround(est->HitRate * est->TotalReferences);
+}
+
+//prints one estimated rate with its 95% confidence interval
+static void PrintEstimate(const char *name, double value, double margin, double scale, int decimals, const char *unit) {
+    if (margin < 0) {
+        printf("%s = %.*f%s (one set, no interval)\n", name, decimals, value * scale, unit);
+    }
+    else {
+        printf("%s = %.*f%s (95%% confidence interval %.*f%s - %.*f%s)\n", name, decimals, value * scale, unit,
+               decimals, (value - margin) * scale, unit, decimals, (value + margin) * scale, unit);
+    }
+}
+
+/*prints the estimates of a set sampled run, and when exact is given (--validate) the
+real values from simulating every set alongside and the error of each estimate*/
+static void PrintSampleEstimate(SampleEstimate *est, CacheState *exact) {
+    printf("\nSET SAMPLING: %d of %d sets, %lld of %lld memory references fell in them\n",
+           est->SampledSets, est->Sets, est->SampledReferences, est->TotalReferences);
+    PrintEstimate("Estimated hit rate", est->HitRate, est->HitRateMargin, 100.0, 2, "%");
+    PrintEstimate("Estimated miss rate", 1.0 - est->HitRate, est->HitRateMargin, 100.0, 2, "%");
+    PrintEstimate("Estimated dirty evictions", est->EvictionRate, est->EvictionRateMargin, (double)est->TotalReferences, 0, "");
+    if (!exact) {
+        return;
+    }
+    long long refs = exact->NumberofMemoryReferences;
+    double hitrate = refs ? (double)exact->ActualHits / refs : 0.0;
+    double evictions = (double)exact->Counters.DirtyEvictions;
+    double hiterror = est->HitRate - hitrate;
+    double evicterror = est->EvictionRate * est->TotalReferences - evictions;
+    printf("Exact hit rate = %.2f%%, error %+.3f points (%s the interval)\n", 100.0 * hitrate, 100.0 * hiterror,
+           est->HitRateMargin >= 0 && fabs(hiterror) <= est->HitRateMargin ? "inside" : "outside");
+    printf("Exact dirty evictions = %.0f, error %+.0f (%+.2f%%, %s the interval)\n", evictions, evicterror,
+           evictions ? 100.0 * evicterror / evictions : 0.0,
+           est->EvictionRateMargin >= 0 && fabs(evicterror) <= est->EvictionRateMargin * est->TotalReferences ? "inside" : "outside");
+}
+
+/*returns the seconds since start*/
+static double ElapsedSeconds(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*creates a buffered writer in front of fp*/
+static OutputBuffer* NewOutputBuffer(FILE *fp) {
+    OutputBuffer *out = (OutputBuffer*)malloc(sizeof(OutputBuffer));
+    out->fp = fp;
+    out->used = 0;
+    out->buffer = (char*)malloc(OUTPUT_BUFFER_SIZE);
+    return out;
+}
+
+/*writes out whatever is in the buffer*/
+static void FlushOutput(OutputBuffer *out) {
+    fwrite(out->buffer, 1, out->used, out->fp);
+    out->used = 0;
+}
+
+/*flushes and frees the writer, the FILE is left open*/
+static void FreeOutputBuffer(OutputBuffer *out) {
+    FlushOutput(out);
+    fflush(out->fp);
+    free(out->buffer);
+    free(out);
+}
+
+/*makes room for n more bytes, flushing the buffer if they do not fit. Every Put function
+reserves exactly what it writes, only a string longer than the whole buffer bypasses it*/
+static inline void ReserveOutput(OutputBuffer *out, size_t n) {
+    if (out->used + n > OUTPUT_BUFFER_SIZE) {
+        FlushOutput(out);
+    }
+}
+static inline void PutString(OutputBuffer *out, const char *str) {
+    size_t n = strlen(str);
+    if (n > OUTPUT_BUFFER_SIZE) {
+        FlushOutput(out);
+        fwrite(str, 1, n, out->fp);
+        return;
+    }
+    ReserveOutput(out, n);
+    memcpy(out->buffer + out->used, str, n);
+    out->used += n;
+}
+static inline void PutChar(OutputBuffer *out, char c) {
+    ReserveOutput(out, 1);
+    out->buffer[out->used++] = c;
+}
+//decimal formatting without printf
+static inline void PutInt(OutputBuffer *out, long long value) {
+    char digits[24];
+    int n = 0;
+    unsigned long long v = value < 0 ? 0 - (unsigned long long)value : (unsigned long long)value;
+    do {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    ReserveOutput(out, n + 1);
+    if (value < 0) {
+        out->buffer[out->used++] = '-';
+    }
+    while (n) {
+        out->buffer[out->used++] = digits[--n];
+    }
+}
+
+static const char *MissClassNames[] = {"", "compulsory", "capacity", "conflict"};
+
+/*writes the header of the main memory location table*/
+static void WriteMemLocTableHeader(OutputBuffer *out) {
+    PutString(out, "\nmain memory address\tmm blk#\t\t   cm set#\t    cm blk#\t     hit/miss\n");
+    PutString(out, "______________________________________________________________________________________\n");
+}
+
+/*writes one line of the main memory location table*/
+static void WriteMemLocTableRow(OutputBuffer *out, FileContents *ref, MemoryLocationTable *row, Memory *userinput) {
+    PutString(out, "  ");
+    PutInt(out, ref->Address);
+    PutString(out, "\t\t\t  ");
+    PutInt(out, row->MainMemoryBlockNum);
+    PutString(out, "\t\t      ");
+    PutInt(out, row->CacheMemorySetNum);
+    PutString(out, "\t\t      ");
+    PutInt(out, row->CacheMemoryBlockNum);
+    if (userinput->SetAssoc != 1) {
+        PutChar(out, '-');
+        PutInt(out, row->CacheMemoryBlockNum + (userinput->SetAssoc) - 1);
+    }
+    if (row->MissClass != MISS_NONE) {
+        PutString(out, "\t\tMiss (");
+        PutString(out, MissClassNames[row->MissClass]);
+        PutString(out, ")\n");
+    }
+    else {
+        PutString(out, row->Hit ? "\t\tHit\n" : "\t\tMiss\n");
+    }
+}
+
+/*writes the final status of the cache, this is the only place the tags are turned into strings*/
+static void WriteFinalCacheStatus(OutputBuffer *out, CacheState *state, Size *BytesAndBits) {
+    int tagbits = BytesAndBits->TagBits > 0 ? BytesAndBits->TagBits : 0;
+    char tagstr[tagbits + 1];
+    PutString(out, "\nFINAL STATUS OF THE CACHE:\n");
+    PutString(out, "Cache blk#\tdirty bit\tvalid bit\ttag\t\tData\n");
+    PutString(out, "______________________________________________________________________________________\n");
+    for (int i = 0; i < state->NumCacheBlocks; i++) {
+        int set = i / state->SetAssoc;
+        int way = i % state->SetAssoc;
+        uint64_t line = state->lines[(size_t)set * state->LineStride + way];
+        int valid = (line & LINE_VALID) != 0;
+        uint64_t tag = line & LINE_TAG_MASK;
+        char dirty = 'X';
+        if (valid && state->WriteBack) {
+            dirty = (line & LINE_DIRTY) ? '1' : '0';
+        }
+        //convert tag to binary
+        for (int t = 0; t < tagbits; t++) {
+            tagstr[t] = valid ? (char)('0' + ((tag >> (tagbits - 1 - t)) & 1)) : 'X';
+        }
+        tagstr[tagbits] = '\0';
+        PutChar(out, ' ');
+        PutInt(out, i);
+        PutString(out, "\t\t ");
+        PutChar(out, dirty);
+        PutString(out, valid ? "\t\t 1\t\t" : "\t\t 0\t\t");
+        PutString(out, tagstr);
+        PutString(out, "\t\tmm blk #");
+        if (valid) {
+            PutInt(out, (long long)tag * state->NumCacheSets + set);
+            if (line & LINE_PREFETCHED) {
+                PutString(out, " (prefetched, unused)");
+            }
+        }
+        else {
+            PutChar(out, '?');
+        }
+        PutChar(out, '\n');
+    }
+    PutChar(out, '\n');
+}
+
+/*writes the hit, miss and write-back counters of every set*/
+static void WriteSetCounters(OutputBuffer *out, CacheState *state) {
+    PutString(out, "PER SET COUNTERS:\n");
+    PutString(out, "cm set#\t\tread hits\tread misses\twrite hits\twrite misses\tdirty evictions\n");
+    PutString(out, "______________________________________________________________________________________\n");
+    for (int j = 0; j < state->NumCacheSets; j++) {
+        CacheCounters *c = &state->SetCounters[j];
+        PutChar(out, ' ');
+        PutInt(out, j);
+        PutString(out, "\t\t ");
+        PutInt(out, c->ReadHits);
+        PutString(out, "\t\t ");
+        PutInt(out, c->ReadMisses);
+        PutString(out, "\t\t ");
+        PutInt(out, c->WriteHits);
+        PutString(out, "\t\t ");
+        PutInt(out, c->WriteMisses);
+        PutString(out, "\t\t ");
+        PutInt(out, c->DirtyEvictions);
+        PutChar(out, '\n');
+    }
+    PutChar(out, '\n');
+}
+
+/*This function writes results as CSV, one line per configuration after a header line,
+returns 0 on success*/
+static int WriteResultsCSV(char *filename, Results *results, int count) {
+    FILE *fp = fopen(filename, "w");
+    if (!fp) {
+        printf("COULD NOT CREATE %s\n", filename);
+        return -1;
+    }
+    fprintf(fp, "main_memory_size,cache_size,block_size,associativity,replacement_policy,write_policy,references,hits,misses,hit_rate,"
+                "read_hits,read_misses,write_hits,write_misses,dirty_evictions,fill_bytes,writeback_bytes,"
+                "write_through_bytes,amat_cycles,seconds\n");
+    for (int i = 0; i < count; i++) {
+        Results *r = &results[i];
+        CacheCounters *c = &r->Counters;
+        fprintf(fp, "%lld,%d,%d,%d,%s,%s,%lld,%lld,%lld,%.6f,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%.4f,%.6f\n",
+                r->config.MainMemorySize, r->config.CacheSize, r->config.CacheBlockSize, r->config.SetAssoc,
+                r->config.ReplacementPolicy, r->config.WritePolicy, r->NumberofMemoryReferences, r->Hits,
+                r->NumberofMemoryReferences - r->Hits,
+                r->NumberofMemoryReferences ? (double)r->Hits / r->NumberofMemoryReferences : 0.0,
+                c->ReadHits, c->ReadMisses, c->WriteHits, c->WriteMisses, c->DirtyEvictions,
+                c->FillBytes, c->WritebackBytes, c->WriteThroughBytes, r->AverageAccessTime, r->Seconds);
+    }
+    fclose(fp);
+    return 0;
+}
+
+//stores value in the next bytes of p little endian
+static unsigned char* PutLittleEndian(unsigned char *p, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        p[i] = (unsigned char)(value >> (8 * i));
+    }
+    return p + bytes;
+}
+
+/*This function writes results in the binary result format, returns 0 on success.
+The file starts with a 16 byte header (little endian):
+  bytes 0-3   magic "CMRS"
+  byte  4     format version
+  byte  5     reserved, 0
+  bytes 6-7   size of each record in bytes
+  bytes 8-15  number of records
+followed by one record per configuration:
+  int64 main memory size (int32 before version 3), int32 cache size, int32 block size, int32 associativity,
+  char replacement policy, char write policy, 6 bytes reserved,
+  int64 references, int64 hits, int64 misses, float64 seconds,
+  int64 read hits, int64 read misses, int64 write hits, int64 write misses,
+  int64 dirty evictions, int64 fill bytes, int64 write-back bytes,
+  int64 write-through bytes, float64 average memory access time in cycles,
+  int32 hit latency, int32 miss penalty (version 2 and up)*/
+static int WriteResultsBinary(char *filename, Results *results, int count) {
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        printf("COULD NOT CREATE %s\n", filename);
+        return -1;
+    }
+    unsigned char record[RESULT_RECORD_SIZE];
+    unsigned char *p = record;
+    memcpy(p, RESULT_FILE_MAGIC, 4);
+    p = PutLittleEndian(p + 4, RESULT_FILE_VERSION, 1);
+    p = PutLittleEndian(p, 0, 1);
+    p = PutLittleEndian(p, RESULT_RECORD_SIZE, 2);
+    PutLittleEndian(p, (uint64_t)count, 8);
+    fwrite(record, 1, 16, fp);
+    for (int i = 0; i < count; i++) {
+        Results *r = &results[i];
+        CacheCounters *c = &r->Counters;
+        uint64_t seconds, amat;
+        memcpy(&seconds, &r->Seconds, sizeof(seconds));
+        memcpy(&amat, &r->AverageAccessTime, sizeof(amat));
+        memset(record, 0, sizeof(record));
+        p = PutLittleEndian(record, (uint64_t)r->config.MainMemorySize, 8);
+        p = PutLittleEndian(p, (uint32_t)r->config.CacheSize, 4);
+        p = PutLittleEndian(p, (uint32_t)r->config.CacheBlockSize, 4);
+        p = PutLittleEndian(p, (uint32_t)r->config.SetAssoc, 4);
+        *p++ = (unsigned char)r->config.ReplacementPolicy[0];
+        *p++ = (unsigned char)r->config.WritePolicy[0];
+        p += 6;
+        p = PutLittleEndian(p, (uint64_t)r->NumberofMemoryReferences, 8);
+        p = PutLittleEndian(p, (uint64_t)r->Hits, 8);
+        p = PutLittleEndian(p, (uint64_t)(r->NumberofMemoryReferences - r->Hits), 8);
+        p = PutLittleEndian(p, seconds, 8);
+        p = PutLittleEndian(p, (uint64_t)c->ReadHits, 8);
+        p = PutLittleEndian(p, (uint64_t)c->ReadMisses, 8);
+        p = PutLittleEndian(p, (uint64_t)c->WriteHits, 8);
+        p = PutLittleEndian(p, (uint64_t)c->WriteMisses, 8);
+        p = PutLittleEndian(p, (uint64_t)c->DirtyEvictions, 8);
+        p = PutLittleEndian(p, (uint64_t)c->FillBytes, 8);
+        p = PutLittleEndian(p, (uint64_t)c->WritebackBytes, 8);
+        p = PutLittleEndian(p, (uint64_t)c->WriteThroughBytes, 8);
+        p = PutLittleEndian(p, amat, 8);
+        p = PutLittleEndian(p, (uint32_t)r->config.HitLatency, 4);
+        PutLittleEndian(p, (uint32_t)r->config.MissPenalty, 4);
+        fwrite(record, 1, RESULT_RECORD_SIZE, fp);
+    }
+    fclose(fp);
+    return 0;
+}
+
+/*writes the CSV and binary result files the user asked for*/
+static int WriteResultFiles(RunOptions *options, Results *results, int count) {
+    int status = 0;
+    if (options->CSVFile[0] && WriteResultsCSV(options->CSVFile, results, count) != 0) {
+        status = -1;
+    }
+    if (options->ResultFile[0] && WriteResultsBinary(options->ResultFile, results, count) != 0) {
+        status = -1;
+    }
+    return status;
+}
+
+//reads a little endian value of the given number of bytes
+static uint64_t GetLittleEndian(const unsigned char *p, int bytes) {
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+//writes count 64 bit words little endian through a small buffer
+static void WriteWords(FILE *fp, const uint64_t *words, size_t count) {
+    unsigned char buffer[4096];
+    while (count) {
+        size_t n = count < sizeof(buffer) / 8 ? count : sizeof(buffer) / 8;
+        for (size_t i = 0; i < n; i++) {
+            PutLittleEndian(buffer + 8 * i, words[i], 8);
+        }
+        fwrite(buffer, 8, n, fp);
+        words += n;
+        count -= n;
+    }
+}
+
+//reads count little endian 64 bit words, returns 0 if the file is too short
+static int ReadWords(FILE *fp, uint64_t *words, size_t count) {
+    unsigned char buffer[4096];
+    while (count) {
+        size_t n = count < sizeof(buffer) / 8 ? count : sizeof(buffer) / 8;
+        if (fread(buffer, 8, n, fp) != n) {
+            return 0;
+        }
+        for (size_t i = 0; i < n; i++) {
+            words[i] = GetLittleEndian(buffer + 8 * i, 8);
+        }
+        words += n;
+        count -= n;
+    }
+    return 1;
+}
+
+//writes the counters of a cache or a set as int64 words
+static void WriteCounters(FILE *fp, const CacheCounters *counters) {
+    uint64_t words[COUNTERS_PER_SET];
+    memcpy(words, counters, sizeof(words));
+    WriteWords(fp, words, COUNTERS_PER_SET);
+}
+static int ReadCounters(FILE *fp, CacheCounters *counters) {
+    uint64_t words[COUNTERS_PER_SET];
+    if (!ReadWords(fp, words, COUNTERS_PER_SET)) {
+        return 0;
+    }
+    memcpy(counters, words, sizeof(words));
+    return 1;
+}
+
+/*fills the first SNAPSHOT_HEADER_SIZE bytes of a snapshot for the cache userinput describes*/
+static void PutSnapshotHeader(unsigned char *header, CacheState *state, Memory *userinput, long long index) {
+    memset(header, 0, SNAPSHOT_HEADER_SIZE);
+    memcpy(header, SNAPSHOT_MAGIC, 4);
+    header[4] = SNAPSHOT_VERSION;
+    unsigned char *p = PutLittleEndian(header + 8, (uint64_t)userinput->MainMemorySize, 8);
+    p = PutLittleEndian(p, (uint32_t)userinput->CacheSize, 4);
+    p = PutLittleEndian(p, (uint32_t)userinput->CacheBlockSize, 4);
+    p = PutLittleEndian(p, (uint32_t)userinput->SetAssoc, 4);
+    *p++ = (unsigned char)userinput->ReplacementPolicy[0];
+    *p++ = (unsigned char)userinput->WritePolicy[0];
+    p = PutLittleEndian(p + 2, (uint64_t)state->ReplacementStride, 8);
+    PutLittleEndian(p, (uint64_t)index, 8);
+}
+
+/*This function writes the whole state of the cache after index memory references to a
+snapshot file, returns 0 on success. The file starts with a 48 byte header (little endian):
+  bytes 0-3   magic "CMSS"
+  byte  4     format version
+  bytes 5-7   reserved, 0
+  bytes 8-15  main memory size
+  bytes 16-27 int32 cache size, block size and associativity
+  byte  28    replacement policy, byte 29 write policy, bytes 30-31 reserved
+  bytes 32-39 bytes of replacement state per set
+  bytes 40-47 number of memory references of the trace already simulated
+followed by int64 hits and references and the 8 int64 counters of the whole cache
+(in CacheCounters order), then for every set its lines as 64 bit words (see
+LINE_VALID), its replacement state as it is kept in memory and its 8 counters*/
+static int SaveSnapshot(char *filename, CacheState *state, Memory *userinput, long long index) {
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        printf("COULD NOT CREATE %s\n", filename);
+        return -1;
+    }
+    unsigned char header[SNAPSHOT_HEADER_SIZE];
+    PutSnapshotHeader(header, state, userinput, index);
+    fwrite(header, 1, SNAPSHOT_HEADER_SIZE, fp);
+    uint64_t totals[2] = {(uint64_t)state->ActualHits, (uint64_t)state->NumberofMemoryReferences};
+    WriteWords(fp, totals, 2);
+    WriteCounters(fp, &state->Counters);
+    for (int j = 0; j < state->NumCacheSets; j++) {
+        WriteWords(fp, &state->lines[(size_t)j * state->LineStride], state->SetAssoc);
+        fwrite(&state->ReplacementState[(size_t)j * state->ReplacementStride], 1, state->ReplacementStride, fp);
+        WriteCounters(fp, &state->SetCounters[j]);
+    }
+    int status = ferror(fp) ? -1 : 0;
+    fclose(fp);
+    if (status != 0) {
+        printf("COULD NOT WRITE %s\n", filename);
+    }
+    return status;
+}
+
+/*This function loads a snapshot written by SaveSnapshot into a freshly initialized cache
+with the same configuration and stores how many references it had simulated in index,
+returns 0 on success*/
+static int LoadSnapshot(char *filename, CacheState *state, Memory *userinput, long long *index) {
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        printf("FILE NOT FOUND\n");
+        return -1;
+    }
+    unsigned char header[SNAPSHOT_HEADER_SIZE];
+    unsigned char expected[SNAPSHOT_HEADER_SIZE];
+    if (fread(header, 1, SNAPSHOT_HEADER_SIZE, fp) != SNAPSHOT_HEADER_SIZE || memcmp(header, SNAPSHOT_MAGIC, 4) != 0 ||
+        header[4] != SNAPSHOT_VERSION) {
+        printf("INVALID SNAPSHOT FILE\n");
+        fclose(fp);
+        return -1;
+    }
+    *index = (long long)GetLittleEndian(header + 40, 8);
+    //everything but the reference index has to match the cache being simulated
+    PutSnapshotHeader(expected, state, userinput, *index);
+    if (memcmp(header, expected, SNAPSHOT_HEADER_SIZE) != 0) {
+        printf("SNAPSHOT WAS TAKEN WITH A DIFFERENT CACHE CONFIGURATION\n");
+        fclose(fp);
+        return -1;
+    }
+    uint64_t totals[2];
+    int ok = ReadWords(fp, totals, 2) && ReadCounters(fp, &state->Counters);
+    state->ActualHits = (long long)totals[0];
+    state->NumberofMemoryReferences = (long long)totals[1];
+    for (int j = 0; ok && j < state->NumCacheSets; j++) {
+        ok = ReadWords(fp, &state->lines[(size_t)j * state->LineStride], state->SetAssoc) &&
+             fread(&state->ReplacementState[(size_t)j * state->ReplacementStride], 1, state->ReplacementStride, fp) == state->ReplacementStride &&
+             ReadCounters(fp, &state->SetCounters[j]);
+    }
+    fclose(fp);
+    if (!ok) {
+        printf("SNAPSHOT FILE IS TRUNCATED\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*zeroes every counter of the cache but keeps its contents, used to measure after a warm start*/
+static void ResetCacheCounters(CacheState *state) {
+    state->ActualHits = 0;
+    state->NumberofMemoryReferences = 0;
+    memset(&state->Counters, 0, sizeof(CacheCounters));
+    memset(state->SetCounters, 0, sizeof(CacheCounters) * state->NumCacheSets);
+}
+
+/*struct used to hand each shard its own copy of the cache state, the copies share
+the tag, bit and replacement arrays but only touch their own range of sets and
+keep their own counters*/
+typedef struct _shard {
+    CacheState state;
+    const unsigned char *trace;
+    size_t traceLength;
+    long long NumberofMemoryReferences;
+    int AddressBits;
+    Memory *userinput;
+    Size *BytesAndBits;
+} Shard;
+
+/*thread function of a shard, scans every reference and skips the ones for other shards' sets*/
+static void* ShardThread(void *arg) {
+    Shard *shard = (Shard*)arg;
+    TraceReader *reader = OpenTraceBuffer(shard->trace, shard->traceLength, shard->NumberofMemoryReferences, shard->AddressBits);
+    FileContents *refs = (FileContents*)malloc(sizeof(FileContents) * TRACE_BLOCK_SIZE);
+    int n;
+    while ((n = ReadReferenceBlock(reader, refs, TRACE_BLOCK_SIZE)) > 0) {
+        SimulateReferences(&shard->state, refs, n);
+    }
+    free(refs);
+    CloseTraceFile(reader);
+    return NULL;
+}
+
+/* this function simulates one cache on several threads: the sets are split into
+numShards contiguous ranges and each thread runs every reference that maps to its
+range, since sets never affect each other the merged counters and the final
+cache are the same as running the references one at a time */
+static void SimulateSharded(TraceReader *reader, CacheState *state, Memory *userinput, Size *BytesAndBits, int numShards) {
+    const unsigned char *trace;
+    size_t traceLength;
+    unsigned char *encoded = NULL;
+    int mapped = reader->Binary && !reader->HasCores;//files with core ids are re-encoded without them
+    if (mapped) {
+        trace = reader->cursor;
+        traceLength = (size_t)(reader->end - reader->cursor);
+    }
+    else {
+        encoded = EncodeTraceBuffer(reader, &traceLength);
+        trace = encoded;
+    }
+    long long count = mapped ? reader->NumberofMemoryReferences : reader->ReferencesRead;
+    if (numShards > state->NumCacheSets) {
+        numShards = state->NumCacheSets;
+    }
+    Shard *shards = (Shard*)malloc(sizeof(Shard) * numShards);
+    pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * numShards);
+    for (int t = 0; t < numShards; t++) {
+        shards[t].state = *state;
+        shards[t].state.FirstSet = (int)((long long)state->NumCacheSets * t / numShards);
+        shards[t].state.EndSet = (int)((long long)state->NumCacheSets * (t + 1) / numShards);
+        shards[t].state.ActualHits = 0;
+        shards[t].state.NumberofMemoryReferences = 0;
+        memset(&shards[t].state.Counters, 0, sizeof(CacheCounters));
+        shards[t].trace = trace;
+        shards[t].traceLength = traceLength;
+        shards[t].NumberofMemoryReferences = count;
+        shards[t].AddressBits = reader->AddressBits;
+        shards[t].userinput = userinput;
+        shards[t].BytesAndBits = BytesAndBits;
+        pthread_create(&threads[t], NULL, ShardThread, &shards[t]);
+    }
+    for (int t = 0; t < numShards; t++) {
+        pthread_join(threads[t], NULL);
+        MergeCacheCounters(state, &shards[t].state);
+    }
+    reader->ReferencesRead = count;//the shards have read every reference between them
+    free(threads);
+    free(shards);
+    free(encoded);
+}
+
+/*runs one reference to address through the cache, returns 1 on a hit, 0 on a miss and
+-1 when the set is not simulated*/
+static inline int AccessAddress(CacheState *state, uint64_t address, int write) {
+    int j;
+    uint64_t tag;
+    uint64_t block = DecomposeAddress(state, address, &j, &tag);
+    if (!SimulatesSet(state, j)) {
+        return -1;
+    }
+    return AccessCacheSet(state, j, block, tag & LINE_TAG_MASK, write, state->SetAssoc, state->Policy, state->Prefetch);
+}
+
+/*struct used to hold the TLBs and page-walk caches of --tlb. Each of them is an LRU
+cache with one byte blocks, looked up with a page number (TLBs) or with the part of
+the address a page table level indexes (walk caches), so hits, misses and the
+replacement all come from the cache code*/
+typedef struct _tlb {
+    TlbConfig config;
+    CacheState *l1;
+    CacheState *l2;//NULL without an L2 TLB
+    CacheState *walkCache[PAGE_TABLE_LEVELS - 1];//NULL without walk caches
+    int Leaf;//page table level holding the page entries: 3 for 4 KiB, 2 for 2 MiB, 1 for 1 GiB pages
+    long long Walks;
+    long long WalkReads;//page table entries read by the walks
+    long long WalkCycles;
+    long long Cycles;//L2 TLB lookups and walks, the L1 TLB is taken to be hidden behind the cache access
+} Tlb;
+
+//address bits each level of a four level x86-64 page table indexes from, PML4 first
+static const int PageTableShifts[PAGE_TABLE_LEVELS] = {39, 30, 21, 12};
+static const char *PageTableNames[PAGE_TABLE_LEVELS] = {"PML4", "PDPT", "PD", "PT"};
+
+//an LRU cache of entries one byte blocks in sets of assoc
+static CacheState* NewTranslationCache(int entries, int assoc) {
+    Memory m;
+    memset(&m, 0, sizeof(m));
+    m.MainMemorySize = (long long)1 << 52;
+    m.CacheSize = entries;
+    m.CacheBlockSize = 1;
+    m.SetAssoc = assoc;
+    strcpy(m.ReplacementPolicy, "L");
+    strcpy(m.WritePolicy, "B");
+    m.WordSize = DEFAULT_WORD_SIZE;
+    Size *BytesAndBits = CalculateSize(&m);
+    CacheState *state = InitializeCache(&m, BytesAndBits);
+    free(BytesAndBits);
+    return state;
+}
+
+static void FreeTlb(Tlb *tlb) {
+    CacheState *caches[PAGE_TABLE_LEVELS + 1] = {tlb->l1, tlb->l2, tlb->walkCache[0], tlb->walkCache[1], tlb->walkCache[2]};
+    for (int i = 0; i < PAGE_TABLE_LEVELS + 1; i++) {
+        if (caches[i]) {
+            FreeCache(caches[i]);
+        }
+    }
+    free(tlb);
+}
+
+/*This function sets up the TLBs and walk caches of config, returns NULL if one cannot be made*/
+static Tlb* NewTlb(TlbConfig *config) {
+    Tlb *tlb = (Tlb*)calloc(1, sizeof(Tlb));
+    tlb->config = *config;
+    tlb->Leaf = (PageTableShifts[PAGE_TABLE_LEVELS - 1] - config->PageShift) / 9 + PAGE_TABLE_LEVELS - 1;
+    tlb->l1 = NewTranslationCache(config->L1Entries, config->L1Assoc);
+    int ok = tlb->l1 != NULL;
+    if (ok && config->L2Entries > 0) {
+        tlb->l2 = NewTranslationCache(config->L2Entries, config->L2Assoc);
+        ok = tlb->l2 != NULL;
+    }
+    //only the levels above the page entries are cached, the page entries are what the TLBs hold
+    for (int d = 0; ok && config->WalkCacheEntries > 0 && d < tlb->Leaf; d++) {
+        tlb->walkCache[d] = NewTranslationCache(config->WalkCacheEntries, config->WalkCacheEntries);
+        ok = tlb->walkCache[d] != NULL;
+    }
+    if (!ok) {
+        FreeTlb(tlb);
+        return NULL;
+    }
+    return tlb;
+}
+
+/*This function walks the page table for address and returns the cycles it took. The
+walk starts below the deepest level whose entry is in its walk cache, and every
+page table entry read after that costs WalkLatency cycles, or goes through the data
+cache when one is given. The page tables sit at PAGE_TABLE_BASE, one flat array per
+level, so the entries of neighbouring pages share cache blocks as they would in a
+real page table*/
+static long long WalkPageTable(Tlb *tlb, uint64_t address, CacheState *data, Memory *userinput) {
+    uint64_t va = address & (((uint64_t)1 << 48) - 1);
+    int start = 0;
+    //a walk cache miss fills it, which is right since the walk is about to read that entry
+    for (int d = tlb->Leaf - 1; d >= 0 && tlb->walkCache[d]; d--) {
+        if (AccessAddress(tlb->walkCache[d], va >> PageTableShifts[d], 0) == 1) {
+            start = d + 1;
+            break;
+        }
+    }
+    long long cycles = 0;
+    for (int l = start; l <= tlb->Leaf; l++) {
+        uint64_t entry = PAGE_TABLE_BASE + ((uint64_t)l << 40) + (va >> PageTableShifts[l]) * 8;
+        int hit = data ? AccessAddress(data, entry, 0) : -1;
+        cycles += hit < 0 ? tlb->config.WalkLatency : userinput->HitLatency + (hit ? 0 : userinput->MissPenalty);
+    }
+    tlb->Walks++;
+    tlb->WalkReads += tlb->Leaf - start + 1;
+    tlb->WalkCycles += cycles;
+    return cycles;
+}
+
+/*This function translates address through the L1 and L2 TLBs and walks the page table
+when both miss, the page table reads go through data unless it is NULL*/
+static void TranslateAddress(Tlb *tlb, uint64_t address, CacheState *data, Memory *userinput) {
+    uint64_t page = address >> tlb->config.PageShift;
+    if (AccessAddress(tlb->l1, page, 0) == 1) {
+        return;
+    }
+    if (tlb->l2) {
+        tlb->Cycles += tlb->config.L2Latency;
+        if (AccessAddress(tlb->l2, page, 0) == 1) {
+            return;
+        }
+    }
+    tlb->Cycles += WalkPageTable(tlb, address, data, userinput);
+}
+
+//prints one TLB's hits and misses and its misses per thousand references
+static void PrintTlbLevel(const char *name, CacheState *state, long long references) {
+    long long misses = state->NumberofMemoryReferences - state->ActualHits;
+    printf("%s TLB (%d entries, %d-way): %lld hits, %lld misses, %.3f misses per kilo-reference\n", name,
+           state->NumCacheBlocks, state->SetAssoc, state->ActualHits, misses, references ? 1000.0 * misses / references : 0.0);
+}
+
+/*prints the TLB misses, the walks and what the translations cost on top of the average memory access time*/
+static void PrintTlbCounters(Tlb *tlb, CacheState *data, Memory *userinput) {
+    long long references = tlb->l1->NumberofMemoryReferences;
+    int shift = tlb->config.PageShift;
+    int unit = shift >= 30 ? 30 : shift >= 20 ? 20 : 10;
+    printf("\nTLB (%d %s pages):\n", 1 << (shift - unit), unit == 30 ? "GiB" : unit == 20 ? "MiB" : "KiB");
+    PrintTlbLevel("L1", tlb->l1, references);
+    if (tlb->l2) {
+        PrintTlbLevel("L2", tlb->l2, references);
+    }
+    printf("Page walks = %lld (%.3f per kilo-reference), page table reads = %lld (%.2f per walk)%s\n", tlb->Walks,
+           references ? 1000.0 * tlb->Walks / references : 0.0, tlb->WalkReads, tlb->Walks ? (double)tlb->WalkReads / tlb->Walks : 0.0,
+           tlb->config.Inject ? ", sent through the data cache" : "");
+    if (tlb->walkCache[0]) {
+        printf("Page-walk cache hits (%d entries per level):", tlb->config.WalkCacheEntries);
+        for (int d = 0; d < tlb->Leaf; d++) {
+            printf(" %s %lld/%lld", PageTableNames[d], tlb->walkCache[d]->ActualHits, tlb->walkCache[d]->NumberofMemoryReferences);
+        }
+        printf("\n");
+    }
+    printf("Walk cycles = %lld (%.2f per walk), translation cycles = %lld (%.3f per reference)\n", tlb->WalkCycles,
+           tlb->Walks ? (double)tlb->WalkCycles / tlb->Walks : 0.0, tlb->Cycles, references ? (double)tlb->Cycles / references : 0.0);
+    //injected page table reads are in the data cache's counters and already cost what the walks did,
+    //so they are taken out of the translation cycles and the average is over the trace's own references
+    long long dataReferences = data->NumberofMemoryReferences - (tlb->config.Inject ? tlb->WalkReads : 0);
+    if (dataReferences > 0 && !data->SampleOnly) {
+        double amat = AverageMemoryAccessTime(userinput, data->ActualHits, data->NumberofMemoryReferences);
+        double cycles = amat * data->NumberofMemoryReferences + tlb->Cycles - (tlb->config.Inject ? tlb->WalkCycles : 0);
+        printf("Average memory access time with translation = %.2f cycles\n", cycles / dataReferences);
+    }
+}
+
+/* this function streams the memory references through the cache, writing the
+memory table as it goes if the user asked for it, only the cache and its
+counters are kept in memory unless the best possible hit rate is requested */
+static MemoryLocationTable* CreateMemLocTable(TraceReader *reader, Memory *userinput, Size *BytesAndBits, RunOptions *options) {
+    CacheState *state = InitializeCache(userinput, BytesAndBits);
+    if (!state) {
+        return NULL;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    FileContents *refs = (FileContents*)malloc(sizeof(FileContents) * TRACE_BLOCK_SIZE);
+    MemoryLocationTable row;
+    OutputBuffer *out = options->OutputMode != OUTPUT_SUMMARY ? NewOutputBuffer(stdout) : NULL;
+    long long every = options->OutputMode == OUTPUT_FULL ? 1 : options->Every;
+    long long untilRow = 1;
+    //main memory block numbers kept for the best possible hit rate
+    uint64_t *blocks = NULL;
+    long long capacity = 0;
+    if (options->SampleFraction > 0) {
+        SelectSampledSets(state, options->SampleFraction);
+        state->SampleOnly = !options->Validate;
+    }
+    //references of the trace simulated so far, a warm start continues where its snapshot was taken
+    long long index = 0;
+    if (options->LoadFile[0]) {
+        if (LoadSnapshot(options->LoadFile, state, userinput, &index) != 0) {
+            if (out) {
+                FreeOutputBuffer(out);
+            }
+            free(refs);
+            FreeCache(state);
+            return NULL;
+        }
+        printf("Loaded %s, continuing after memory reference %lld\n", options->LoadFile, index);
+        if (options->ResetCounters) {
+            ResetCacheCounters(state);
+        }
+        for (long long skipped = 0; skipped < index; ) {
+            long long left = index - skipped;
+            int n = ReadReferenceBlock(reader, refs, left < TRACE_BLOCK_SIZE ? (int)left : TRACE_BLOCK_SIZE);
+            if (n == 0) {
+                break;
+            }
+            skipped += n;
+        }
+    }
+    Tlb *tlb = NULL;
+    if (options->Tlb.Enabled && !(tlb = NewTlb(&options->Tlb))) {
+        if (out) {
+            FreeOutputBuffer(out);
+        }
+        free(refs);
+        FreeCache(state);
+        return NULL;
+    }
+    long long end = options->Length > 0 ? index + options->Length : LLONG_MAX;
+    long long nextSave = options->SaveAt > 0 ? options->SaveAt : LLONG_MAX;
+    if (options->SaveEvery > 0) {
+        nextSave = (index / options->SaveEvery + 1) * options->SaveEvery;
+    }
+
+    if (out) {
+        WriteMemLocTableHeader(out);
+    }
+    MissClassifier *mc = options->Classify ? NewMissClassifier(state->NumCacheBlocks, state->NumCacheSets) : NULL;
+    row.MissClass = MISS_NONE;
+    if (options->PrefetchKind != PREFETCH_NONE) {
+        NewPrefetcher(state, userinput, options->PrefetchKind, options->PrefetchDegree, options->PrefetchDistance);
+    }
+    //page table reads injected into the data cache come before the reference that missed in the TLBs
+    CacheState *walkData = tlb && options->Tlb.Inject ? state : NULL;
+    //the table, the best possible hit rate, snapshots and the miss classes need the references in order,
+    //and prefetches cross sets, so only shard without them
+    if (options->Threads > 1 && !out && !options->BestHitRate && !options->SaveFile[0] && !options->LoadFile[0] &&
+        options->Length == 0 && !mc && !state->Prefetch && !tlb) {
+        SimulateSharded(reader, state, userinput, BytesAndBits, options->Threads);
+    }
+    else {
+        int n;
+        while (index < end && (n = ReadReferenceBlock(reader, refs, end - index < TRACE_BLOCK_SIZE ? (int)(end - index) : TRACE_BLOCK_SIZE)) > 0) {
+            //nothing to do between the references of this block, run it through the kernel
+            if (!out && !options->BestHitRate && !mc && !walkData && nextSave - index > n) {
+                for (int i = 0; tlb && i < n; i++) {
+                    TranslateAddress(tlb, refs[i].Address, NULL, userinput);
+                }
+                SimulateReferences(state, refs, n);
+                index += n;
+                continue;
+            }
+            for (int i = 0; i < n; i++) {
+                if (tlb) {
+                    TranslateAddress(tlb, refs[i].Address, walkData, userinput);
+                }
+                SimulateReference(state, &refs[i], userinput, BytesAndBits, &row);
+                if (mc) {
+                    row.MissClass = ClassifyMiss(mc, row.MainMemoryBlockNum, row.CacheMemorySetNum, row.Hit);
+                }
+                if (++index == nextSave) {
+                    char filename[300];
+                    if (options->SaveEvery > 0) {
+                        snprintf(filename, sizeof(filename), "%s.%lld", options->SaveFile, index);
+                        nextSave += options->SaveEvery;
+                    }
+                    else {
+                        snprintf(filename, sizeof(filename), "%s", options->SaveFile);
+                        nextSave = LLONG_MAX;
+                    }
+                    SaveSnapshot(filename, state, userinput, index);
+                }
+                if (out && --untilRow == 0) {
+                    WriteMemLocTableRow(out, &refs[i], &row, userinput);
+                    untilRow = every;
+                }
+                if (options->BestHitRate) {
+                    if (state->NumberofMemoryReferences > capacity) {
+                        capacity = capacity ? capacity * 2 : 1024;
+                        blocks = (uint64_t*)realloc(blocks, sizeof(uint64_t) * capacity);
+                    }
+                    blocks[state->NumberofMemoryReferences - 1] = row.MainMemoryBlockNum;
+                }
+            }
+        }
+    }
+    free(refs);
+    //without a reference count to save at, the snapshot is of the end of the run
+    if (options->SaveFile[0] && options->SaveAt == 0 && options->SaveEvery == 0) {
+        SaveSnapshot(options->SaveFile, state, userinput, index);
+    }
+    SampleEstimate estimate;
+    if (state->SampledSets) {
+        estimate = EstimateFromSampledSets(state, reader->ReferencesRead);
+        if (state->SampleOnly) {
+            ExtrapolateSampledCounters(state, &estimate);
+        }
+    }
+    Results results;
+    results.config = *userinput;
+    results.NumberofMemoryReferences = state->NumberofMemoryReferences;
+    results.Hits = state->ActualHits;
+    results.Counters = state->Counters;
+    results.AverageAccessTime = AverageMemoryAccessTime(userinput, state->ActualHits, state->NumberofMemoryReferences);
+    results.Seconds = ElapsedSeconds(&start);
+    //printing final status of the cache
+    if (options->OutputMode == OUTPUT_FULL) {
+        WriteFinalCacheStatus(out, state, BytesAndBits);
+        WriteSetCounters(out, state);
+    }
+    else if (out) {
+        PutChar(out, '\n');
+    }
+    if (out) {
+        FreeOutputBuffer(out);
+    }
+    else {
+        printf("\n");
+    }
+    //print actual cache hit rate
+    long long numMemRef = state->NumberofMemoryReferences;
+    printf("%s Hit Rate = %lld/%lld = %.2f%%\n", state->SampleOnly ? "Estimated" : "Actual", state->ActualHits, numMemRef, numMemRef ? (float)100*state->ActualHits/numMemRef : 0.0);
+    PrintCacheCounters(state, userinput);
+    if (state->SampledSets) {
+        PrintSampleEstimate(&estimate, state->SampleOnly ? NULL : state);
+    }
+    if (mc) {
+        PrintMissClassification(mc);
+        FreeMissClassifier(mc);
+    }
+    if (state->Prefetch) {
+        PrintPrefetchCounters(state);
+        FreePrefetcher(state->Prefetch);
+    }
+    if (tlb) {
+        PrintTlbCounters(tlb, state, userinput);
+        FreeTlb(tlb);
+    }
+
+    //calculates best possible hit rate
+    if (options->BestHitRate) {
+        CalculateBestPossibleHitRate(blocks, numMemRef, userinput, BytesAndBits);
+        free(blocks);
+    }
+    WriteResultFiles(options, &results, 1);
+    FreeCache(state);
+    return NULL;
+}
+
+/* this function will  be called by the CreateMemLocTable function and calculate cm blk#,
+returns the jth cache block number of the set the memory block maps to*/
+static int CalculateCacheMemBlkNum(MemoryLocationTable *row, Size *BytesAndBits, Memory *userinput, int j) {
+    return (row->CacheMemorySetNum * userinput->SetAssoc) + j;
+}
+
+/*struct used as an open addressing hash table from main memory block number to
+an int value, a value of -1 marks an empty slot*/
+typedef struct _blocktable {
+    uint64_t *keys;
+    long long *values;//64 bits so MIN can store reference indexes of any trace
+    size_t size;
+    size_t count;
+} BlockTable;
+
+static inline size_t HashBlock(uint64_t block, size_t tableSize) {
+    uint64_t h = block * 0x9e3779b97f4a7c15ULL;
+    return (size_t)(h ^ (h >> 32)) & (tableSize - 1);
+}
+
+/*allocates an empty table, size must be a power of two*/
+static void InitBlockTable(BlockTable *table, size_t size) {
+    table->size = size;
+    table->count = 0;
+    table->keys = (uint64_t*)malloc(sizeof(uint64_t) * size);
+    table->values = (long long*)malloc(sizeof(long long) * size);
+    memset(table->values, 0xff, sizeof(long long) * size);
+}
+
+static void FreeBlockTable(BlockTable *table) {
+    free(table->keys);
+    free(table->values);
+}
+
+/*finds the slot holding block, or the empty slot it would go in*/
+static inline size_t FindBlockSlot(BlockTable *table, uint64_t block) {
+    size_t slot = HashBlock(block, table->size);
+    while (table->values[slot] >= 0 && table->keys[slot] != block) {
+        slot = (slot + 1) & (table->size - 1);
+    }
+    return slot;
+}
+
+/*doubles the table*/
+static void GrowBlockTable(BlockTable *table) {
+    uint64_t *oldkeys = table->keys;
+    long long *oldvalues = table->values;
+    size_t oldsize = table->size;
+    InitBlockTable(table, oldsize * 2);
+    for (size_t i = 0; i < oldsize; i++) {
+        if (oldvalues[i] >= 0) {
+            size_t slot = FindBlockSlot(table, oldkeys[i]);
+            table->keys[slot] = oldkeys[i];
+            table->values[slot] = oldvalues[i];
+            table->count++;
+        }
+    }
+    free(oldkeys);
+    free(oldvalues);
+}
+
+/*stores value for block, which must be >= 0, growing the table once it is half full*/
+static inline void SetBlockValue(BlockTable *table, uint64_t block, long long value) {
+    size_t slot = FindBlockSlot(table, block);
+    if (table->values[slot] < 0) {
+        table->keys[slot] = block;
+        table->count++;
+    }
+    table->values[slot] = value;
+    if (table->count * 2 > table->size) {
+        GrowBlockTable(table);
+    }
+}
+
+/* this function calculates the best possible hit rate of the user's cache with
+Belady's MIN policy: a reverse pass over the block numbers finds when each block
+is referenced next, then the references are run through a cache of the same
+geometry where a full set replaces the block whose next reference is furthest
+away. Each set keeps its ways in a max-heap ordered by next reference, so a
+reference costs O(log ways) */
+static void CalculateBestPossibleHitRate(uint64_t *blocks, long long size, Memory *userinput, Size *BytesAndBits) {
+    int sets = BytesAndBits->NumCacheSets;
+    int ways = userinput->SetAssoc;
+    //nextUse[i] = index of the next reference to blocks[i], or UINT64_MAX if there is none
+    uint64_t *nextUse = (uint64_t*)malloc(sizeof(uint64_t) * (size > 0 ? size : 1));
+    BlockTable seen;
+    InitBlockTable(&seen, 1 << 16);
+    for (long long i = size - 1; i >= 0; i--) {
+        size_t slot = FindBlockSlot(&seen, blocks[i]);
+        nextUse[i] = seen.values[slot] >= 0 ? (uint64_t)seen.values[slot] : UINT64_MAX;
+        SetBlockValue(&seen, blocks[i], i);
+    }
+    FreeBlockTable(&seen);
+
+    //per set: the line of each way (holding the whole block number), the next use of each way and the heap of ways
+    int stride = (ways + 7) & ~7;
+    uint64_t *lines = (uint64_t*)AllocateAligned(sizeof(uint64_t) * (size_t)stride * sets);
+    if (!lines) {
+        free(nextUse);
+        return;
+    }
+    uint64_t *key = (uint64_t*)malloc(sizeof(uint64_t) * (size_t)ways * sets);
+    uint16_t *heap = (uint16_t*)malloc(sizeof(uint16_t) * (size_t)ways * sets);
+    uint16_t *pos = (uint16_t*)malloc(sizeof(uint16_t) * (size_t)ways * sets);
+    int *filled = (int*)calloc(sets, sizeof(int));
+
+    long long hit = 0;
+    for (long long i = 0; i < size; i++) {
+        int set = (int)(blocks[i] % (uint64_t)sets);
+        uint64_t *setlines = &lines[(size_t)set * stride];
+        uint64_t block = blocks[i] & LINE_TAG_MASK;
+        uint64_t *setkey = &key[(size_t)set * ways];
+        uint16_t *setheap = &heap[(size_t)set * ways];
+        uint16_t *setpos = &pos[(size_t)set * ways];
+        int empty;
+        int way = ProbeSet(setlines, ways, block, &empty);
+        int at;
+        if (way >= 0) {
+            hit++;
+            at = setpos[way];
+        }
+        else if (filled[set] < ways) {
+            //sets fill in way order, the new way goes at the bottom of the heap
+            way = filled[set]++;
+            setlines[way] = LINE_VALID | block;
+            setheap[way] = (uint16_t)way;
+            setpos[way] = (uint16_t)way;
+            at = way;
+        }
+        else {
+            //replace the block referenced furthest in the future, the root of the heap
+            way = setheap[0];
+            setlines[way] = LINE_VALID | block;
+            at = 0;
+        }
+        setkey[way] = nextUse[i];
+        //the key of the way at heap position at changed, move it up or down
+        while (at > 0 && setkey[setheap[(at - 1) / 2]] < setkey[setheap[at]]) {
+            int parent = (at - 1) / 2;
+            uint16_t t = setheap[at];
+            setheap[at] = setheap[parent];
+            setheap[parent] = t;
+            setpos[setheap[at]] = (uint16_t)at;
+            setpos[setheap[parent]] = (uint16_t)parent;
+            at = parent;
+        }
+        int count = filled[set];
+        for (;;) {
+            int largest = at;
+            int l = 2 * at + 1;
+            int r = l + 1;
+            if (l < count && setkey[setheap[l]] > setkey[setheap[largest]]) {
+                largest = l;
+            }
+            if (r < count && setkey[setheap[r]] > setkey[setheap[largest]]) {
+                largest = r;
+            }
+            if (largest == at) {
+                break;
+            }
+            uint16_t t = setheap[at];
+            setheap[at] = setheap[largest];
+            setheap[largest] = t;
+            setpos[setheap[at]] = (uint16_t)at;
+            setpos[setheap[largest]] = (uint16_t)largest;
+            at = largest;
+        }
+    }
+    free(lines);
+    free(key);
+    free(heap);
+    free(pos);
+    free(filled);
+    free(nextUse);
+
+    printf("\n");
+    double hitrate = size ? 100.0 * hit / size : 0;
+    printf("Best possible hit rate = %lld/%lld = %.2f%%\n", hit, size, hitrate);
+}
+
+/*struct used to classify the misses of the cache as compulsory, capacity or conflict
+misses. One hash table holds every block referenced so far with its node in a
+shadow fully associative LRU cache of the same number of blocks, or SHADOW_EVICTED
+once the shadow cache has dropped it. The shadow cache keeps its blocks in an
+intrusive doubly linked list in MRU order, so a reference costs one hash lookup*/
+struct _missclassifier {
+    BlockTable blocks;
+    uint64_t *nodeBlocks;
+    int *prev;
+    int *next;
+    int head;//most recently used node
+    int tail;//least recently used node
+    int capacity;
+    int count;
+    long long Compulsory;
+    long long Capacity;
+    long long Conflict;
+    long long *SetConflicts;
+    int NumCacheSets;
+};
+
+/*allocates a classifier for a cache of capacity blocks in sets sets*/
+static MissClassifier* NewMissClassifier(int capacity, int sets) {
+    MissClassifier *mc = (MissClassifier*)calloc(1, sizeof(MissClassifier));
+    InitBlockTable(&mc->blocks, 1 << 16);
+    mc->nodeBlocks = (uint64_t*)malloc(sizeof(uint64_t) * capacity);
+    mc->prev = (int*)malloc(sizeof(int) * capacity);
+    mc->next = (int*)malloc(sizeof(int) * capacity);
+    mc->head = -1;
+    mc->tail = -1;
+    mc->capacity = capacity;
+    mc->SetConflicts = (long long*)calloc(sets, sizeof(long long));
+    mc->NumCacheSets = sets;
+    return mc;
+}
+
+static void FreeMissClassifier(MissClassifier *mc) {
+    FreeBlockTable(&mc->blocks);
+    free(mc->nodeBlocks);
+    free(mc->prev);
+    free(mc->next);
+    free(mc->SetConflicts);
+    free(mc);
+}
+
+//unlinks a node from the shadow cache's list
+static inline void UnlinkShadowNode(MissClassifier *mc, int node) {
+    if (mc->prev[node] >= 0) {
+        mc->next[mc->prev[node]] = mc->next[node];
+    }
+    else {
+        mc->head = mc->next[node];
+    }
+    if (mc->next[node] >= 0) {
+        mc->prev[mc->next[node]] = mc->prev[node];
+    }
+    else {
+        mc->tail = mc->prev[node];
+    }
+}
+
+//links a node in as the most recently used
+static inline void PushShadowNode(MissClassifier *mc, int node) {
+    mc->prev[node] = -1;
+    mc->next[node] = mc->head;
+    if (mc->head >= 0) {
+        mc->prev[mc->head] = node;
+    }
+    mc->head = node;
+    if (mc->tail < 0) {
+        mc->tail = node;
+    }
+}
+
+/*This function runs one reference through the shadow cache and returns the class of
+the miss (MISS_COMPULSORY, MISS_CAPACITY or MISS_CONFLICT) when the real cache missed,
+or MISS_NONE when it hit. A miss on a block never seen before is compulsory, a miss
+the fully associative cache would also have had is a capacity miss, and the rest
+are conflict misses*/
+static int ClassifyMiss(MissClassifier *mc, uint64_t block, int set, int hit) {
+    size_t slot = FindBlockSlot(&mc->blocks, block);
+    int value = mc->blocks.values[slot];
+    int missClass = MISS_NONE;
+    if (value >= 0 && value != SHADOW_EVICTED) {//in the shadow cache, make it the most recently used
+        if (value != mc->head) {
+            UnlinkShadowNode(mc, value);
+            PushShadowNode(mc, value);
+        }
+        if (!hit) {
+            missClass = MISS_CONFLICT;
+            mc->Conflict++;
+            mc->SetConflicts[set]++;
+        }
+        return missClass;
+    }
+    if (!hit) {
+        missClass = value < 0 ? MISS_COMPULSORY : MISS_CAPACITY;
+        if (value < 0) {
+            mc->Compulsory++;
+        }
+        else {
+            mc->Capacity++;
+        }
+    }
+    int node;
+    if (mc->count < mc->capacity) {
+        node = mc->count++;
+    }
+    else {//drop the least recently used block, it stays in the table as seen
+        node = mc->tail;
+        UnlinkShadowNode(mc, node);
+        mc->blocks.values[FindBlockSlot(&mc->blocks, mc->nodeBlocks[node])] = SHADOW_EVICTED;
+    }
+    mc->nodeBlocks[node] = block;
+    PushShadowNode(mc, node);
+    SetBlockValue(&mc->blocks, block, node);
+    return missClass;
+}
+
+/*prints the number of misses of each class and the sets with the most conflict misses*/
+static void PrintMissClassification(MissClassifier *mc) {
+    long long misses = mc->Compulsory + mc->Capacity + mc->Conflict;
+    printf("\nMISS CLASSIFICATION (shadow fully associative LRU cache of %d blocks):\n", mc->capacity);
+    printf("Compulsory misses = %lld (%.2f%% of misses)\n", mc->Compulsory, misses ? 100.0 * mc->Compulsory / misses : 0.0);
+    printf("Capacity misses = %lld (%.2f%% of misses)\n", mc->Capacity, misses ? 100.0 * mc->Capacity / misses : 0.0);
+    printf("Conflict misses = %lld (%.2f%% of misses)\n", mc->Conflict, misses ? 100.0 * mc->Conflict / misses : 0.0);
+    if (mc->Conflict == 0) {
+        return;
+    }
+    //the CONFLICT_HOTSPOTS sets with the most conflict misses, kept sorted by insertion
+    int top[CONFLICT_HOTSPOTS];
+    int found = 0;
+    for (int j = 0; j < mc->NumCacheSets; j++) {
+        long long count = mc->SetConflicts[j];
+        if (count == 0 || (found == CONFLICT_HOTSPOTS && count <= mc->SetConflicts[top[found - 1]])) {
+            continue;
+        }
+        int at = found < CONFLICT_HOTSPOTS ? found++ : found - 1;
+        while (at > 0 && mc->SetConflicts[top[at - 1]] < count) {
+            top[at] = top[at - 1];
+            at--;
+        }
+        top[at] = j;
+    }
+    printf("Sets with the most conflict misses (an even spread would be %.1f per set):\n", (double)mc->Conflict / mc->NumCacheSets);
+    printf("cm set#\t\tconflict misses\t\tshare\n");
+    printf("______________________________________________________________________________________\n");
+    for (int i = 0; i < found; i++) {
+        long long count = mc->SetConflicts[top[i]];
+        printf(" %d\t\t %lld\t\t\t %.2f%%\n", top[i], count, 100.0 * count / mc->Conflict);
+    }
+}
+
+/*struct used to find the LRU stack distance of every reference in one pass:
+a hash table maps each main memory block to the time of its last reference
+and a Fenwick tree holds a 1 at every such time, so the number of different
+blocks referenced since the last reference to a block is a prefix sum.
+Times are renumbered whenever the tree fills up, so memory only grows with
+the number of different blocks and not with the length of the trace*/
+typedef struct _stackdistance {
+    BlockTable table;//last reference time of each block
+    int *tree;
+    int capacity;
+    int now;
+} StackDistance;
+
+/*struct used to keep a most recently used list of up to Depth blocks for
+every set of one set count, used for the set-associative part of the sweep*/
+typedef struct _setstacks {
+    int NumSets;
+    int Depth;
+    uint64_t *blocks;
+    long long *hits;//hits[d] = references found at depth d of their set
+} SetStacks;
+
+static void FenwickAdd(int *tree, int capacity, int pos, int value) {
+    for (int i = pos + 1; i <= capacity; i += i & -i) {
+        tree[i] += value;
+    }
+}
+
+//returns the number of marked times in [0, pos]
+static int FenwickSum(int *tree, int pos) {
+    int sum = 0;
+    for (int i = pos + 1; i > 0; i -= i & -i) {
+        sum += tree[i];
+    }
+    return sum;
+}
+
+static int CompareTimes(const void *a, const void *b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+/*renumbers the last reference times 0..count-1 keeping their order and rebuilds the tree,
+the tree is doubled if the blocks would take up more than half of it*/
+static void CompactTimes(StackDistance *sd) {
+    BlockTable *table = &sd->table;
+    int *sorted = (int*)malloc(sizeof(int) * (table->count + 1));
+    size_t n = 0;
+    for (size_t i = 0; i < table->size; i++) {
+        if (table->values[i] >= 0) {
+            sorted[n++] = table->values[i];
+        }
+    }
+    qsort(sorted, n, sizeof(int), CompareTimes);
+    //old time -> new time through a table indexed by old time
+    int *renumber = (int*)malloc(sizeof(int) * sd->capacity);
+    for (size_t i = 0; i < n; i++) {
+        renumber[sorted[i]] = (int)i;
+    }
+    for (size_t i = 0; i < table->size; i++) {
+        if (table->values[i] >= 0) {
+            table->values[i] = renumber[table->values[i]];
+        }
+    }
+    free(renumber);
+    free(sorted);
+    if (n * 2 > (size_t)sd->capacity) {
+        sd->capacity *= 2;
+        free(sd->tree);
+        sd->tree = (int*)malloc(sizeof(int) * (sd->capacity + 1));
+    }
+    //linear time build of a tree with ones in [0, n)
+    memset(sd->tree, 0, sizeof(int) * (sd->capacity + 1));
+    for (int i = 1; i <= sd->capacity; i++) {
+        if (i <= (int)n) {
+            sd->tree[i] += 1;
+        }
+        int parent = i + (i & -i);
+        if (parent <= sd->capacity) {
+            sd->tree[parent] += sd->tree[i];
+        }
+    }
+    sd->now = (int)n;
+}
+
+/*returns the number of different blocks referenced since block was last referenced,
+or -1 if this is the first reference to block*/
+static long long NextStackDistance(StackDistance *sd, uint64_t block) {
+    if (sd->now == sd->capacity) {
+        CompactTimes(sd);
+    }
+    size_t slot = FindBlockSlot(&sd->table, block);
+    long long distance = -1;
+    if (sd->table.values[slot] >= 0) {
+        int last = sd->table.values[slot];
+        distance = FenwickSum(sd->tree, sd->now - 1) - FenwickSum(sd->tree, last);
+        FenwickAdd(sd->tree, sd->capacity, last, -1);
+    }
+    SetBlockValue(&sd->table, block, sd->now);
+    FenwickAdd(sd->tree, sd->capacity, sd->now, 1);
+    sd->now++;
+    return distance;
+}
+
+/*moves block to the front of its set's MRU list and counts the depth it was found at*/
+static inline void UpdateSetStack(SetStacks *stacks, uint64_t block) {
+    uint64_t *list = &stacks->blocks[(size_t)(block & (uint64_t)(stacks->NumSets - 1)) * stacks->Depth];
+    uint64_t carry = block;
+    for (int d = 0; d < stacks->Depth; d++) {
+        uint64_t current = list[d];
+        list[d] = carry;
+        if (current == block) {
+            stacks->hits[d]++;
+            return;
+        }
+        carry = current;
+    }
+}
+
+/* this function makes a single pass over the memory references and prints the LRU
+hit rate of every fully associative cache size up to the size given, the reuse
+distance histogram and the hit rate of every power of two set count and
+associativity (up to the one given) at the given block size */
+static int SweepCacheSizes(TraceReader *reader, Memory *userinput) {
+    int blocksize = userinput->CacheBlockSize;
+    int maxblocks = userinput->CacheSize / blocksize;
+    int maxassoc = userinput->SetAssoc;
+    if ((maxblocks & (maxblocks - 1)) != 0 || (maxassoc & (maxassoc - 1)) != 0) {
+        printf("the sweep needs a power of two number of cache blocks and associativity\n");
+        return -1;
+    }
+    StackDistance sd;
+    InitBlockTable(&sd.table, 1 << 16);
+    sd.capacity = 1 << 20;
+    sd.tree = (int*)calloc(sd.capacity + 1, sizeof(int));
+    sd.now = 0;
+    //histogram[d] = references with stack distance d, the last entry counts everything >= maxblocks
+    long long *histogram = (long long*)calloc(maxblocks + 1, sizeof(long long));
+    long long cold = 0;
+
+    //one set of MRU lists per power of two set count, deep enough for every associativity that fits
+    int numstacks = 0;
+    for (int sets = 1; sets <= maxblocks; sets *= 2) {
+        numstacks++;
+    }
+    SetStacks *stacks = (SetStacks*)malloc(sizeof(SetStacks) * numstacks);
+    for (int i = 0; i < numstacks; i++) {
+        stacks[i].NumSets = 1 << i;
+        stacks[i].Depth = (maxblocks >> i) < maxassoc ? (maxblocks >> i) : maxassoc;
+        stacks[i].blocks = (uint64_t*)malloc(sizeof(uint64_t) * (size_t)stacks[i].NumSets * stacks[i].Depth);
+        memset(stacks[i].blocks, 0xff, sizeof(uint64_t) * (size_t)stacks[i].NumSets * stacks[i].Depth);
+        stacks[i].hits = (long long*)calloc(stacks[i].Depth, sizeof(long long));
+    }
+
+    FileContents *refs = (FileContents*)malloc(sizeof(FileContents) * TRACE_BLOCK_SIZE);
+    long long total = 0;
+    int n;
+    while ((n = ReadReferenceBlock(reader, refs, TRACE_BLOCK_SIZE)) > 0) {
+        for (int i = 0; i < n; i++) {
+            uint64_t block = refs[i].Address / (uint64_t)blocksize;
+            long long distance = NextStackDistance(&sd, block);
+            if (distance < 0) {
+                cold++;
+            }
+            else {
+                histogram[distance < maxblocks ? distance : maxblocks]++;
+            }
+            for (int s = 0; s < numstacks; s++) {
+                UpdateSetStack(&stacks[s], block);
+            }
+        }
+        total += n;
+    }
+    free(refs);
+
+    printf("\nMISS RATIO CURVE (fully associative LRU, %d byte blocks, %lld memory references):\n", blocksize, total);
+    printf("cache size\tblocks\t\thits\t\thit rate\tmiss rate\n");
+    printf("______________________________________________________________________________________\n");
+    long long hits = 0;
+    int next = 1;
+    for (int d = 0; d < maxblocks; d++) {
+        hits += histogram[d];
+        if (d + 1 == next) {
+            double rate = total ? 100.0 * hits / total : 0.0;
+            printf(" %lld\t\t %d\t\t %lld\t\t %.2f%%\t\t %.2f%%\n", (long long)next * blocksize, next, hits, rate, 100.0 - rate);
+            next *= 2;
+        }
+    }
+
+    printf("\nREUSE DISTANCE HISTOGRAM (different blocks referenced in between):\n");
+    printf("distance\t\treferences\n");
+    printf("______________________________________________________________________________________\n");
+    for (int lo = 0; lo < maxblocks; lo = lo ? lo * 2 : 1) {
+        int hi = lo ? lo * 2 - 1 : 0;
+        long long count = 0;
+        for (int d = lo; d <= hi; d++) {
+            count += histogram[d];
+        }
+        if (lo == hi) {
+            printf(" %d\t\t\t %lld\n", lo, count);
+        }
+        else {
+            printf(" %d-%d\t\t\t %lld\n", lo, hi, count);
+        }
+    }
+    printf(" >= %d\t\t\t %lld\n", maxblocks, histogram[maxblocks]);
+    printf(" first reference\t %lld\n", cold);
+
+    printf("\nSET-ASSOCIATIVE LRU HIT RATES (%d byte blocks):\n", blocksize);
+    printf("cache size");
+    for (int assoc = 1; assoc <= maxassoc; assoc *= 2) {
+        printf("\t%d-way", assoc);
+    }
+    printf("\n______________________________________________________________________________________\n");
+    for (int blocks = 1; blocks <= maxblocks; blocks *= 2) {
+        printf(" %lld\t", (long long)blocks * blocksize);
+        for (int assoc = 1; assoc <= maxassoc; assoc *= 2) {
+            if (assoc > blocks) {
+                printf("\t-");
+                continue;
+            }
+            //blocks/assoc sets, the set stacks are indexed by log2 of the set count
+            SetStacks *st = &stacks[__builtin_ctz(blocks / assoc)];
+            long long sethits = 0;
+            for (int d = 0; d < assoc; d++) {
+                sethits += st->hits[d];
+            }
+            printf("\t%.2f%%", total ? 100.0 * sethits / total : 0.0);
+        }
+        printf("\n");
+    }
+    printf("\n");
+
+    for (int i = 0; i < numstacks; i++) {
+        free(stacks[i].blocks);
+        free(stacks[i].hits);
+    }
+    free(stacks);
+    free(histogram);
+    FreeBlockTable(&sd.table);
+    free(sd.tree);
+    return 0;
+}
+
+/*struct used to hold one configuration of a batch run and its results*/
+typedef struct _batchjob {
+    Results result;
+    int Status;
+} BatchJob;
+/*struct used as one worker's queue of batch jobs, the owner takes jobs from
+the tail and idle workers steal them from the head*/
+typedef struct _workqueue {
+    pthread_mutex_t lock;
+    int *jobs;
+    int head;
+    int tail;
+} WorkQueue;
+/*struct shared by the workers of a batch run, nothing in it is written after
+the workers start except the queues and each job's own results*/
+typedef struct _batchrun {
+    const unsigned char *trace;
+    size_t traceLength;
+    long long NumberofMemoryReferences;
+    int AddressBits;
+    double SampleFraction;
+    BatchJob *jobs;
+    int numJobs;
+    WorkQueue *queues;
+    int numThreads;
+} BatchRun;
+/*struct used to hand each worker its number*/
+typedef struct _batchworker {
+    BatchRun *run;
+    int id;
+} BatchWorker;
+
+/*This function runs every reference of reader through a fresh cache built from one
+configuration without printing anything, only through sampleFraction of the sets
+when it is above 0 with the results extrapolated to the whole cache, returns 0 on success*/
+static int SimulateConfiguration(TraceReader *reader, Memory *config, Results *result, double sampleFraction) {
+    Size *BytesAndBits = CalculateSize(config);
+    CacheState *state = InitializeCache(config, BytesAndBits);
+    if (!state) {
+        free(BytesAndBits);
+        return -1;
+    }
+    if (sampleFraction > 0) {
+        SelectSampledSets(state, sampleFraction);
+        state->SampleOnly = 1;
+    }
+    FileContents *refs = (FileContents*)malloc(sizeof(FileContents) * TRACE_BLOCK_SIZE);
+    int n;
+    while ((n = ReadReferenceBlock(reader, refs, TRACE_BLOCK_SIZE)) > 0) {
+        SimulateReferences(state, refs, n);
+    }
+    if (state->SampleOnly) {
+        SampleEstimate estimate = EstimateFromSampledSets(state, reader->ReferencesRead);
+        ExtrapolateSampledCounters(state, &estimate);
+    }
+    result->Hits = state->ActualHits;
+    result->NumberofMemoryReferences = state->NumberofMemoryReferences;
+    result->Counters = state->Counters;
+    result->AverageAccessTime = AverageMemoryAccessTime(config, state->ActualHits, state->NumberofMemoryReferences);
+    free(refs);
+    FreeCache(state);
+    free(BytesAndBits);
+    return 0;
+}
+
+/*takes the next job for worker id, from its own queue first and otherwise from
+the other workers' queues, returns -1 once every queue is empty*/
+static int NextBatchJob(BatchRun *run, int id) {
+    WorkQueue *own = &run->queues[id];
+    int job = -1;
+    pthread_mutex_lock(&own->lock);
+    if (own->tail > own->head) {
+        job = own->jobs[--own->tail];
+    }
+    pthread_mutex_unlock(&own->lock);
+    for (int i = 1; job < 0 && i < run->numThreads; i++) {
+        WorkQueue *victim = &run->queues[(id + i) % run->numThreads];
+        pthread_mutex_lock(&victim->lock);
+        if (victim->tail > victim->head) {
+            job = victim->jobs[victim->head++];
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return job;
+}
+
+/*thread function of a batch worker*/
+static void* BatchWorkerThread(void *arg) {
+    BatchWorker *worker = (BatchWorker*)arg;
+    BatchRun *run = worker->run;
+    int job;
+    while ((job = NextBatchJob(run, worker->id)) >= 0) {
+        BatchJob *current = &run->jobs[job];
+        //every job decodes the shared trace through its own reader
+        TraceReader *reader = OpenTraceBuffer(run->trace, run->traceLength, run->NumberofMemoryReferences, run->AddressBits);
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        current->Status = SimulateConfiguration(reader, &current->result.config, &current->result, run->SampleFraction);
+        current->result.Seconds = ElapsedSeconds(&start);
+        CloseTraceFile(reader);
+    }
+    return NULL;
+}
+
+/*This function reads the configurations of a batch run, one per line:
+  <cache size> <block size> <associativity> <replacement policy> <write policy>
+blank lines and lines starting with # are skipped, returns the number read or -1*/
+static int ReadBatchFile(char *filename, Memory *defaults, BatchJob **jobs) {
+    FILE *fp = fopen(filename, "r");
+    if (!fp) {
+        printf("FILE NOT FOUND\n");
+        return -1;
+    }
+    int count = 0;
+    int capacity = 16;
+    *jobs = (BatchJob*)calloc(capacity, sizeof(BatchJob));
+    char line[256];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+        char *p = line;
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') {
+            continue;
+        }
+        Memory config = *defaults;
+        char repl[8];
+        char write[8];
+        if (sscanf(p, "%d %d %d %7s %7s", &config.CacheSize, &config.CacheBlockSize, &config.SetAssoc, repl, write) != 5) {
+            printf("%s line %d: expected <cache size> <block size> <associativity> <replacement> <write>\n", filename, lineno);
+            fclose(fp);
+            free(*jobs);
+            return -1;
+        }
+        snprintf(config.ReplacementPolicy, 2, "%.1s", repl);
+        snprintf(config.WritePolicy, 2, "%.1s", write);
+        if (config.CacheBlockSize <= 0 || config.SetAssoc <= 0 ||
+            config.CacheSize < config.CacheBlockSize * config.SetAssoc ||
+            !FindReplacementPolicy(config.ReplacementPolicy[0])) {
+            printf("%s line %d: invalid configuration\n", filename, lineno);
+            fclose(fp);
+            free(*jobs);
+            return -1;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            *jobs = (BatchJob*)realloc(*jobs, sizeof(BatchJob) * capacity);
+        }
+        memset(&(*jobs)[count], 0, sizeof(BatchJob));
+        (*jobs)[count].result.config = config;
+        count++;
+    }
+    fclose(fp);
+    return count;
+}
+
+/* this function simulates every configuration of a batch file against the same
+memory references, the references are parsed once into a read-only buffer shared
+by all the worker threads and the results are printed as one table at the end */
+static int RunBatch(char *batchfile, char *filename, Memory *defaults, int numThreads, RunOptions *options) {
+    BatchJob *jobs;
+    int numJobs = ReadBatchFile(batchfile, defaults, &jobs);
+    if (numJobs <= 0) {
+        if (numJobs == 0) {
+            printf("no configurations in %s\n", batchfile);
+        }
+        return -1;
+    }
+    TraceReader *reader = OpenTraceFile(filename);
+    if (!reader) {
+        free(jobs);
+        return -1;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    BatchRun run;
+    unsigned char *encoded = NULL;
+    //already in the shared format, use the mapping itself, files with core ids are re-encoded without them
+    int mapped = reader->Binary && !reader->HasCores;
+    if (mapped) {
+        run.trace = reader->cursor;
+        run.traceLength = (size_t)(reader->end - reader->cursor);
+    }
+    else {
+        encoded = EncodeTraceBuffer(reader, &run.traceLength);
+        run.trace = encoded;
+    }
+    run.NumberofMemoryReferences = mapped ? reader->NumberofMemoryReferences : reader->ReferencesRead;
+    run.AddressBits = reader->AddressBits;
+    run.SampleFraction = options->SampleFraction;
+    double parseSeconds = ElapsedSeconds(&start);
+
+    if (numThreads > numJobs) {
+        numThreads = numJobs;
+    }
+    run.jobs = jobs;
+    run.numJobs = numJobs;
+    run.numThreads = numThreads;
+    run.queues = (WorkQueue*)malloc(sizeof(WorkQueue) * numThreads);
+    for (int t = 0; t < numThreads; t++) {
+        pthread_mutex_init(&run.queues[t].lock, NULL);
+        run.queues[t].jobs = (int*)malloc(sizeof(int) * numJobs);
+        run.queues[t].head = 0;
+        run.queues[t].tail = 0;
+    }
+    //deal the jobs out round robin, stealing evens out the differences in run time
+    for (int i = 0; i < numJobs; i++) {
+        WorkQueue *q = &run.queues[i % numThreads];
+        q->jobs[q->tail++] = i;
+    }
+    pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * numThreads);
+    BatchWorker *workers = (BatchWorker*)malloc(sizeof(BatchWorker) * numThreads);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int t = 0; t < numThreads; t++) {
+        workers[t].run = &run;
+        workers[t].id = t;
+        pthread_create(&threads[t], NULL, BatchWorkerThread, &workers[t]);
+    }
+    for (int t = 0; t < numThreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    double simulateSeconds = ElapsedSeconds(&start);
+
+    printf("\nBATCH RESULTS (%d configurations, %d threads, %lld memory references):\n", numJobs, numThreads, run.NumberofMemoryReferences);
+    if (run.SampleFraction > 0) {
+        printf("estimated from %.4g of the sets of each cache\n", run.SampleFraction);
+    }
+    printf("cache size\tblk size\tassoc\trepl\twrite\thits\t\thit rate\twrite-backs\tAMAT\tseconds\n");
+    printf("______________________________________________________________________________________\n");
+    //results of the jobs that ran, in the order of the batch file
+    Results *results = (Results*)malloc(sizeof(Results) * numJobs);
+    int numResults = 0;
+    for (int i = 0; i < numJobs; i++) {
+        Results *job = &jobs[i].result;
+        printf(" %d\t\t %d\t\t %d\t %s\t %s\t", job->config.CacheSize, job->config.CacheBlockSize, job->config.SetAssoc,
+               job->config.ReplacementPolicy, job->config.WritePolicy);
+        if (jobs[i].Status != 0) {
+            printf(" failed\n");
+            continue;
+        }
+        printf(" %lld\t\t %.2f%%\t\t %lld\t\t %.2f\t %.3f\n", job->Hits,
+               job->NumberofMemoryReferences ? 100.0 * job->Hits / job->NumberofMemoryReferences : 0.0,
+               job->Counters.DirtyEvictions, job->AverageAccessTime, job->Seconds);
+        results[numResults++] = *job;
+    }
+    printf("\nparsed in %.3f s, simulated in %.3f s\n\n", parseSeconds, simulateSeconds);
+
+    for (int t = 0; t < numThreads; t++) {
+        pthread_mutex_destroy(&run.queues[t].lock);
+        free(run.queues[t].jobs);
+    }
+    free(run.queues);
+    free(threads);
+    free(workers);
+    free(encoded);
+    free(jobs);
+    CloseTraceFile(reader);
+    int status = WriteResultFiles(options, results, numResults);
+    free(results);
+    return status;
+}
+
+/*struct used to pass one access from a cache level to the level below it*/
+typedef struct _levelmessage {
+    uint64_t Address;
+    uint32_t Kind;//one of the ACCESS_ values
+} LevelMessage;
+
+/*single producer single consumer ring buffer connecting two pipeline stages. The
+producer and the consumer each keep a private copy of the other side's index and
+only publish their own index every RING_PUBLISH_BATCH messages, so the shared
+cache lines move between cores once per batch instead of once per message*/
+typedef struct _ring {
+    _Alignas(64) atomic_size_t head;//next message to read, written by the consumer
+    _Alignas(64) atomic_size_t tail;//next free slot, written by the producer
+    _Alignas(64) size_t producerTail;
+    size_t producerHead;//producer's copy of head
+    _Alignas(64) size_t consumerHead;
+    size_t consumerTail;//consumer's copy of tail
+    LevelMessage *slots;
+    size_t mask;
+} Ring;
+
+/*struct used to hold one level of the cache hierarchy*/
+typedef struct _cachelevel {
+    Memory config;
+    Size *BytesAndBits;
+    CacheState *state;
+    long long WritebacksReceived;//dirty blocks written back by the level above
+    long long VictimsReceived;//clean blocks handed down by the level above (exclusive)
+    long long BackInvalidations;//blocks removed because the level below evicted them (inclusive)
+} CacheLevel;
+
+/*struct used to hold a whole cache hierarchy, level 0 is the L1 cache*/
+typedef struct _hierarchy {
+    CacheLevel levels[MAX_CACHE_LEVELS];
+    int NumLevels;
+    int Inclusion;
+    int Pipelined;
+    Ring *rings;//rings[i] carries the accesses level i sends to level i + 1
+    long long MemoryReads;
+    long long MemoryReadBytes;
+    long long MemoryWriteBytes;
+} Hierarchy;
+
+static void InitRing(Ring *ring, size_t size) {
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->producerTail = 0;
+    ring->producerHead = 0;
+    ring->consumerHead = 0;
+    ring->consumerTail = 0;
+    ring->slots = (LevelMessage*)malloc(sizeof(LevelMessage) * size);
+    ring->mask = size - 1;
+}
+
+//makes the messages written so far visible to the consumer
+static inline void PublishRing(Ring *ring) {
+    atomic_store_explicit(&ring->tail, ring->producerTail, memory_order_release);
+}
+
+static void RingPush(Ring *ring, uint64_t address, uint32_t kind) {
+    while (ring->producerTail - ring->producerHead > ring->mask) {//looks full
+        ring->producerHead = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (ring->producerTail - ring->producerHead > ring->mask) {
+            PublishRing(ring);
+            sched_yield();
+        }
+    }
+    LevelMessage *slot = &ring->slots[ring->producerTail & ring->mask];
+    slot->Address = address;
+    slot->Kind = kind;
+    ring->producerTail++;
+    if ((ring->producerTail & (RING_PUBLISH_BATCH - 1)) == 0 || kind == ACCESS_END) {
+        PublishRing(ring);
+    }
+}
+
+//waits for the next message, output is published first so the next stage never waits on a stalled one
+static LevelMessage RingPop(Ring *ring, Ring *output) {
+    while (ring->consumerHead == ring->consumerTail) {
+        ring->consumerTail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (ring->consumerHead == ring->consumerTail) {
+            atomic_store_explicit(&ring->head, ring->consumerHead, memory_order_release);
+            if (output) {
+                PublishRing(output);
+            }
+            sched_yield();
+        }
+    }
+    LevelMessage message = ring->slots[ring->consumerHead & ring->mask];
+    ring->consumerHead++;
+    if ((ring->consumerHead & (RING_PUBLISH_BATCH - 1)) == 0) {
+        atomic_store_explicit(&ring->head, ring->consumerHead, memory_order_release);
+    }
+    return message;
+}
+
+static int AccessLevel();
+
+/*sends an access from level i to the level below it, or to main memory from the last
+level. Returns 1 when a block read from an exclusive level below was dirty*/
+static int SendBelow(Hierarchy *h, int i, uint64_t address, int kind) {
+    if (i == h->NumLevels - 1) {
+        int blocksize = h->levels[i].config.CacheBlockSize;
+        if (kind == ACCESS_READ) {
+            h->MemoryReads++;
+            h->MemoryReadBytes += blocksize;
+        }
+        else if (kind == ACCESS_WRITE) {
+            h->MemoryWriteBytes += h->levels[i].config.WordSize;
+        }
+        else if (kind == ACCESS_WRITEBACK) {
+            h->MemoryWriteBytes += blocksize;
+        }
+        return 0;
+    }
+    if (h->Pipelined) {
+        RingPush(&h->rings[i], address, kind);
+        return 0;
+    }
+    return AccessLevel(h, i + 1, address, kind);
+}
+
+/*removes every block of the levels above level i that lies inside the block of
+level i starting at address, returns 1 if any of them was dirty*/
+static int InvalidateAbove(Hierarchy *h, int i, uint64_t address) {
+    int dirty = 0;
+    int blocksize = h->levels[i].config.CacheBlockSize;
+    for (int u = 0; u < i; u++) {
+        CacheState *state = h->levels[u].state;
+        int upperblocksize = h->levels[u].config.CacheBlockSize;
+        for (uint64_t a = address; a < address + (uint64_t)blocksize; a += upperblocksize) {
+            uint64_t block = a / (uint64_t)upperblocksize;
+            uint64_t *lines = &state->lines[(size_t)(block % (uint64_t)state->NumCacheSets) * state->LineStride];
+            int empty;
+            int k = ProbeSet(lines, state->SetAssoc, (block / (uint64_t)state->NumCacheSets) & LINE_TAG_MASK, &empty);
+            if (k >= 0) {
+                dirty |= (lines[k] & LINE_DIRTY) != 0;
+                lines[k] = 0;
+                h->levels[u].BackInvalidations++;
+            }
+        }
+    }
+    return dirty;
+}
+
+/*picks the way of set j of level i that a new block goes into and sends the block
+it replaces to the level below: dirty blocks are written back, and clean ones are
+handed down too when the levels are exclusive*/
+static int FillLevelWay(Hierarchy *h, int i, int j, uint64_t tag) {
+    CacheLevel *level = &h->levels[i];
+    CacheState *state = level->state;
+    uint64_t *lines = &state->lines[(size_t)j * state->LineStride];
+    unsigned char *replacement = &state->ReplacementState[(size_t)j * state->ReplacementStride];
+    //probed again because the level below may have invalidated lines of this set since the miss
+    int k;
+    ProbeSet(lines, state->SetAssoc, tag, &k);
+    if (k < 0) {
+        k = state->Policy->Victim(replacement, state->SetAssoc);
+        uint64_t victim = ((lines[k] & LINE_TAG_MASK) * (uint64_t)state->NumCacheSets + j) * (uint64_t)level->config.CacheBlockSize;
+        int wasDirty = (lines[k] & LINE_DIRTY) != 0;
+        if (h->Inclusion == INCLUSION_INCLUSIVE && i > 0) {
+            wasDirty |= InvalidateAbove(h, i, victim);
+        }
+        if (wasDirty) {
+            state->Counters.DirtyEvictions++;
+            state->Counters.WritebackBytes += state->BlockSize;
+            state->SetCounters[j].DirtyEvictions++;
+            state->SetCounters[j].WritebackBytes += state->BlockSize;
+            SendBelow(h, i, victim, ACCESS_WRITEBACK);
+        }
+        else if (h->Inclusion == INCLUSION_EXCLUSIVE) {
+            SendBelow(h, i, victim, ACCESS_VICTIM);
+        }
+    }
+    lines[k] = LINE_VALID | tag;
+    state->Policy->Fill(replacement, state->SetAssoc, k);
+    return k;
+}
+
+/*This function runs one access through level i of the hierarchy. Level 0 gets the
+references of the trace and behaves like the single cache. The levels below get the
+read misses, write-through writes and evicted blocks of the level above; write-through
+writes that miss a lower level are passed on without allocating a block. Returns 1 when
+an exclusive level hands a dirty block up*/
+static int AccessLevel(Hierarchy *h, int i, uint64_t address, int kind) {
+    CacheLevel *level = &h->levels[i];
+    CacheState *state = level->state;
+    uint64_t block = address / (uint64_t)level->config.CacheBlockSize;
+    int j = (int)(block % (uint64_t)state->NumCacheSets);
+    uint64_t tag = (block / (uint64_t)state->NumCacheSets) & LINE_TAG_MASK;
+    uint64_t *lines = &state->lines[(size_t)j * state->LineStride];
+    unsigned char *replacement = &state->ReplacementState[(size_t)j * state->ReplacementStride];
+    CacheCounters *setcounters = &state->SetCounters[j];
+    //blocks found in a lower exclusive level move up instead of being copied
+    int exclusive = h->Inclusion == INCLUSION_EXCLUSIVE && i > 0;
+    int empty;
+    int k = ProbeSet(lines, state->SetAssoc, tag, &empty);
+
+    if (kind == ACCESS_WRITEBACK || kind == ACCESS_VICTIM) {
+        if (kind == ACCESS_WRITEBACK) {
+            level->WritebacksReceived++;
+        }
+        else {
+            level->VictimsReceived++;
+        }
+        if (k < 0) {
+            k = FillLevelWay(h, i, j, tag);
+        }
+        else {
+            state->Policy->Hit(replacement, state->SetAssoc, k);
+        }
+        if (kind == ACCESS_WRITEBACK) {
+            if (state->WriteBack) {
+                lines[k] |= LINE_DIRTY;
+            }
+            else {
+                SendBelow(h, i, block * (uint64_t)level->config.CacheBlockSize, ACCESS_WRITEBACK);
+            }
+        }
+        return 0;
+    }
+    int write = kind == ACCESS_WRITE;
+    state->NumberofMemoryReferences++;
+    if (k >= 0) {
+        state->ActualHits++;
+        if (write) {
+            state->Counters.WriteHits++;
+            setcounters->WriteHits++;
+            if (state->WriteBack) {
+                lines[k] |= LINE_DIRTY;
+            }
+            else {
+                state->Counters.WriteThroughBytes += state->WordSize;
+                SendBelow(h, i, address, ACCESS_WRITE);
+            }
+        }
+        else {
+            state->Counters.ReadHits++;
+            setcounters->ReadHits++;
+        }
+        if (exclusive) {
+            int wasDirty = (lines[k] & LINE_DIRTY) != 0;
+            lines[k] = 0;
+            return wasDirty;
+        }
+        state->Policy->Hit(replacement, state->SetAssoc, k);
+        return 0;
+    }
+    if (write) {
+        state->Counters.WriteMisses++;
+        setcounters->WriteMisses++;
+        if (i > 0) {
+            SendBelow(h, i, address, ACCESS_WRITE);
+            return 0;
+        }
+    }
+    else {
+        state->Counters.ReadMisses++;
+        setcounters->ReadMisses++;
+    }
+    int dirtyBelow = SendBelow(h, i, address, ACCESS_READ);
+    if (exclusive) {//the block goes straight to the level above
+        return dirtyBelow;
+    }
+    state->Counters.FillBytes += state->BlockSize;
+    setcounters->FillBytes += state->BlockSize;
+    k = FillLevelWay(h, i, j, tag);
+    if ((write || dirtyBelow) && state->WriteBack) {
+        lines[k] |= LINE_DIRTY;
+    }
+    else if (dirtyBelow) {
+        SendBelow(h, i, block * (uint64_t)level->config.CacheBlockSize, ACCESS_WRITEBACK);
+    }
+    if (write && state->WriteThrough) {
+        state->Counters.WriteThroughBytes += state->WordSize;
+        SendBelow(h, i, address, ACCESS_WRITE);
+    }
+    return 0;
+}
+
+/*struct used to hand a pipeline stage its level*/
+typedef struct _stage {
+    Hierarchy *h;
+    int level;
+} Stage;
+
+/*thread function of the pipeline stage of one level below L1, runs until the end marker*/
+static void* LevelStageThread(void *arg) {
+    Stage *stage = (Stage*)arg;
+    Hierarchy *h = stage->h;
+    int i = stage->level;
+    Ring *output = i < h->NumLevels - 1 ? &h->rings[i] : NULL;
+    for (;;) {
+        LevelMessage message = RingPop(&h->rings[i - 1], output);
+        if (message.Kind == ACCESS_END) {
+            break;
+        }
+        AccessLevel(h, i, message.Address, (int)message.Kind);
+    }
+    if (output) {
+        RingPush(output, 0, ACCESS_END);
+    }
+    return NULL;
+}
+
+static const char *InclusionNames[] = {"NINE", "inclusive", "exclusive"};
+
+/* this function simulates a hierarchy of up to MAX_CACHE_LEVELS caches, userinput is
+the L1 cache and the levels below it come from the options. The misses and evicted
+blocks of every level are fed to the next one, and main memory sits below the last.
+Without inclusion (NINE) nothing ever flows back up, so every level runs as its own
+pipeline stage on its own thread, connected to the level above by a ring buffer.
+Inclusive levels remove blocks from the levels above when they evict them and exclusive
+levels hand their blocks up, so those hierarchies run one access at a time */
+static int SimulateHierarchy(TraceReader *reader, Memory *userinput, RunOptions *options) {
+    Hierarchy h;
+    memset(&h, 0, sizeof(h));
+    h.NumLevels = options->NumLowerLevels + 1;
+    h.Inclusion = options->Inclusion;
+    h.Pipelined = h.Inclusion == INCLUSION_NINE && options->Threads != 1;
+    int status = 0;
+    for (int i = 0; i < h.NumLevels; i++) {
+        CacheLevel *level = &h.levels[i];
+        level->config = i == 0 ? *userinput : options->Levels[i - 1];
+        level->config.MainMemorySize = userinput->MainMemorySize;
+        level->config.WordSize = userinput->WordSize;
+        level->BytesAndBits = CalculateSize(&level->config);
+        level->state = InitializeCache(&level->config, level->BytesAndBits);
+        if (!level->state) {
+            status = -1;
+        }
+    }
+    if (status != 0) {
+        for (int i = 0; i < h.NumLevels; i++) {
+            if (h.levels[i].state) {
+                FreeCache(h.levels[i].state);
+            }
+            free(h.levels[i].BytesAndBits);
+        }
+        return -1;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_t threads[MAX_CACHE_LEVELS];
+    Stage stages[MAX_CACHE_LEVELS];
+    if (h.Pipelined) {
+        h.rings = (Ring*)aligned_alloc(64, sizeof(Ring) * (h.NumLevels - 1));
+        for (int i = 1; i < h.NumLevels; i++) {
+            InitRing(&h.rings[i - 1], RING_SIZE);
+            stages[i].h = &h;
+            stages[i].level = i;
+            pthread_create(&threads[i], NULL, LevelStageThread, &stages[i]);
+        }
+    }
+    FileContents *refs = (FileContents*)malloc(sizeof(FileContents) * TRACE_BLOCK_SIZE);
+    int n;
+    while ((n = ReadReferenceBlock(reader, refs, TRACE_BLOCK_SIZE)) > 0) {
+        for (int r = 0; r < n; r++) {
+            AccessLevel(&h, 0, refs[r].Address, refs[r].ReadOrWrite == 1 ? ACCESS_WRITE : ACCESS_READ);
+        }
+    }
+    free(refs);
+    if (h.Pipelined) {
+        RingPush(&h.rings[0], 0, ACCESS_END);
+        for (int i = 1; i < h.NumLevels; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        for (int i = 0; i < h.NumLevels - 1; i++) {
+            free(h.rings[i].slots);
+        }
+        free(h.rings);
+    }
+    double seconds = ElapsedSeconds(&start);
+
+    //average access time of an access that reaches each level, from the bottom up
+    double amat[MAX_CACHE_LEVELS + 1];
+    amat[h.NumLevels] = userinput->MissPenalty;
+    for (int i = h.NumLevels - 1; i >= 0; i--) {
+        CacheState *state = h.levels[i].state;
+        double missrate = state->NumberofMemoryReferences ? (double)(state->NumberofMemoryReferences - state->ActualHits) / state->NumberofMemoryReferences : 0.0;
+        amat[i] = h.levels[i].config.HitLatency + missrate * amat[i + 1];
+    }
+    printf("\nCACHE HIERARCHY (%s, %s):\n", InclusionNames[h.Inclusion],
+           h.Pipelined ? "one thread per level" : "one thread");
+    printf("level\tcache size\tblk size\tassoc\trepl\twrite\taccesses\thits\t\thit rate\twrite-backs\tback-inval\n");
+    printf("______________________________________________________________________________________\n");
+    Results *results = (Results*)malloc(sizeof(Results) * h.NumLevels);
+    for (int i = 0; i < h.NumLevels; i++) {
+        CacheLevel *level = &h.levels[i];
+        CacheState *state = level->state;
+        printf(" L%d\t %d\t\t %d\t\t %d\t %s\t %s\t %lld\t\t %lld\t\t %.2f%%\t\t %lld\t\t %lld\n", i + 1,
+               level->config.CacheSize, level->config.CacheBlockSize, level->config.SetAssoc,
+               level->config.ReplacementPolicy, level->config.WritePolicy, state->NumberofMemoryReferences,
+               state->ActualHits, state->NumberofMemoryReferences ? 100.0 * state->ActualHits / state->NumberofMemoryReferences : 0.0,
+               state->Counters.DirtyEvictions, level->BackInvalidations);
+        results[i].config = level->config;
+        results[i].NumberofMemoryReferences = state->NumberofMemoryReferences;
+        results[i].Hits = state->ActualHits;
+        results[i].Counters = state->Counters;
+        results[i].AverageAccessTime = amat[i];
+        results[i].Seconds = seconds;
+    }
+    printf("\nMain memory: %lld block reads (%lld bytes), %lld bytes written\n", h.MemoryReads, h.MemoryReadBytes, h.MemoryWriteBytes);
+    printf("Average memory access time = %.2f cycles\n", amat[0]);
+    printf("Simulated in %.3f s\n", seconds);
+    status = WriteResultFiles(options, results, h.NumLevels);
+    free(results);
+    for (int i = 0; i < h.NumLevels; i++) {
+        FreeCache(h.levels[i].state);
+        free(h.levels[i].BytesAndBits);
+    }
+    return status;
+}
+
+/*This function reads one level of the hierarchy given as
+<cache size>,<block size>,<associativity>[,<replacement>[,<write>[,<hit latency>]]]
+returns 0 on success*/
+static int ParseCacheLevel(char *spec, Memory *level, int hitLatency) {
+    char replacement[2] = "L", write[2] = "B";
+    int latency = hitLatency;
+    int count = sscanf(spec, "%d,%d,%d,%1[^,],%1[^,],%d", &level->CacheSize, &level->CacheBlockSize,
+                       &level->SetAssoc, replacement, write, &latency);
+    if (count < 3) {
+        return -1;
+    }
+    strcpy(level->ReplacementPolicy, replacement);
+    strcpy(level->WritePolicy, write);
+    level->HitLatency = latency;
+    level->MissPenalty = 0;
+    level->WordSize = DEFAULT_WORD_SIZE;
+    return 0;
+}
+
+/*struct used to hold the coherence state of one block in the directory. The MESI
+state of a core's copy follows from it: M when the line is dirty, E when the core is
+the only sharer and the line is clean, S when there are other sharers*/
+typedef struct _directoryentry {
+    uint64_t Block;
+    uint64_t Sharers;//bit per core holding the block
+    uint64_t Invalidated;//cores whose copy another core's write invalidated, until they miss on it
+    uint64_t WrittenWords;//words written since the block's last invalidation
+    int LastWriter;//core that last took write ownership, -1 before any write
+    long long PingPongs;//times write ownership moved to a different core
+} DirectoryEntry;
+/*struct used to count the coherence events of one core*/
+typedef struct _coherencecounters {
+    long long CoherenceMisses;
+    long long TrueSharingMisses;
+    long long FalseSharingMisses;
+    long long InvalidationsReceived;
+    long long InvalidationsSent;
+    long long Upgrades;//write hits on blocks other cores also held
+    long long CacheToCache;//misses served by another core's copy
+} CoherenceCounters;
+/*struct used to pass batches of references from the reading thread to the
+threads of the multi-core engine, two buffers so the next batch is read while
+the current one is simulated*/
+typedef struct _corebatches {
+    FileContents *refs[2];
+    int count[2];
+    pthread_barrier_t barrier;
+} CoreBatches;
+/*struct used by one thread of the multi-core engine: a copy of every core's cache
+restricted to the thread's range of sets, and the directory of the blocks that map
+to those sets. A block's coherence only involves the same set of every core, so the
+threads never touch each other's state*/
+typedef struct _coreshard {
+    int NumCores;
+    CacheState *cores;
+    CoherenceCounters *counters;
+    BlockTable index;//block -> position in entries
+    DirectoryEntry *entries;
+    int NumEntries;
+    int EntryCapacity;
+    int WordSize;
+    int WordsPerBlock;
+    CoreBatches *batches;
+} CoreShard;
+
+/*returns the directory entry of block, adding an empty one if create is set and there
+is none, or NULL. Adding an entry can move the others*/
+static DirectoryEntry* FindDirectoryEntry(CoreShard *shard, uint64_t block, int create) {
+    size_t slot = FindBlockSlot(&shard->index, block);
+    if (shard->index.values[slot] >= 0) {
+        return &shard->entries[shard->index.values[slot]];
+    }
+    if (!create) {
+        return NULL;
+    }
+    if (shard->NumEntries == shard->EntryCapacity) {
+        shard->EntryCapacity = shard->EntryCapacity ? shard->EntryCapacity * 2 : 1024;
+        shard->entries = (DirectoryEntry*)realloc(shard->entries, sizeof(DirectoryEntry) * shard->EntryCapacity);
+    }
+    DirectoryEntry *e = &shard->entries[shard->NumEntries];
+    memset(e, 0, sizeof(DirectoryEntry));
+    e->Block = block;
+    e->LastWriter = -1;
+    SetBlockValue(&shard->index, block, shard->NumEntries++);
+    return e;
+}
+
+/*invalidates the copies of the block held by the cores in others before core c writes it,
+a dirty copy is handed to c instead of being written back*/
+static void InvalidateSharers(CoreShard *shard, DirectoryEntry *e, int j, uint64_t tag, uint64_t others, int c) {
+    for (uint64_t left = others; left; left &= left - 1) {
+        int o = __builtin_ctzll(left);
+        CacheState *other = &shard->cores[o];
+        uint64_t *lines = &other->lines[(size_t)j * other->LineStride];
+        int empty;
+        int k = ProbeSet(lines, other->SetAssoc, tag, &empty);
+        if (k >= 0) {
+            lines[k] = 0;
+        }
+        shard->counters[o].InvalidationsReceived++;
+        shard->counters[c].InvalidationsSent++;
+    }
+    e->Sharers &= ~others;
+    e->Invalidated |= others;
+    e->WrittenWords = 0;
+}
+
+//true if a has more ping-pongs than b, ties go to the lower block so every thread count lists the same blocks
+static inline int MorePingPongs(const DirectoryEntry *a, const DirectoryEntry *b) {
+    return a->PingPongs > b->PingPongs || (a->PingPongs == b->PingPongs && a->Block < b->Block);
+}
+
+//core c takes write ownership of the block and writes one word of it
+static inline void WriteOwnership(DirectoryEntry *e, int c, uint64_t word) {
+    if (e->LastWriter >= 0 && e->LastWriter != c) {
+        e->PingPongs++;
+    }
+    e->LastWriter = c;
+    e->WrittenWords |= word;
+}
+
+/*This function runs one reference of a multi-core trace through the private cache of
+its core and keeps the caches coherent with MESI through the directory:
+  read miss:  a modified copy in another core is written back and both keep it shared
+  write miss: every other copy is invalidated, a modified one is passed over
+  write hit:  a shared copy invalidates the others first (an upgrade), an exclusive
+              one becomes modified without telling anyone
+A miss on a block the core lost to another core's write is a coherence miss, true
+sharing when it reads a word written since that invalidation, false sharing otherwise*/
+static void AccessCore(CoreShard *shard, FileContents *ref) {
+    int j;
+    uint64_t tag;
+    uint64_t block = DecomposeAddress(&shard->cores[0], ref->Address, &j, &tag);
+    if (j < shard->cores[0].FirstSet || j >= shard->cores[0].EndSet) {
+        return;
+    }
+    int c = ref->Core;
+    CacheState *cache = &shard->cores[c];
+    CoherenceCounters *coherence = &shard->counters[c];
+    uint64_t me = (uint64_t)1 << c;
+    int write = ref->ReadOrWrite == 1;
+    int word = (int)(ref->Address % (uint64_t)cache->BlockSize) / shard->WordSize;
+    uint64_t wordbit = (uint64_t)1 << (shard->WordsPerBlock > 64 ? word * 64 / shard->WordsPerBlock : word);
+    tag &= LINE_TAG_MASK;
+    cache->NumberofMemoryReferences++;
+    uint64_t *lines = &cache->lines[(size_t)j * cache->LineStride];
+    unsigned char *replacement = &cache->ReplacementState[(size_t)j * cache->ReplacementStride];
+    CacheCounters *setcounters = &cache->SetCounters[j];
+    int empty;
+    int k = ProbeSet(lines, cache->SetAssoc, tag, &empty);
+    if (k >= 0) {
+        cache->ActualHits++;
+        if (write) {
+            cache->Counters.WriteHits++;
+            setcounters->WriteHits++;
+            DirectoryEntry *e = FindDirectoryEntry(shard, block, 0);
+            if (!(lines[k] & LINE_DIRTY)) {
+                uint64_t others = e->Sharers & ~me;
+                if (others) {
+                    coherence->Upgrades++;
+                    InvalidateSharers(shard, e, j, tag, others, c);
+                }
+                lines[k] |= LINE_DIRTY;
+            }
+            WriteOwnership(e, c, wordbit);
+        }
+        else {
+            cache->Counters.ReadHits++;
+            setcounters->ReadHits++;
+        }
+        cache->Policy->Hit(replacement, cache->SetAssoc, k);
+        return;
+    }
+    if (write) {
+        cache->Counters.WriteMisses++;
+        setcounters->WriteMisses++;
+    }
+    else {
+        cache->Counters.ReadMisses++;
+        setcounters->ReadMisses++;
+    }
+    //the victim's entry already exists, so it is updated before the new block's entry can move it
+    k = empty;
+    if (k < 0) {
+        k = cache->Policy->Victim(replacement, cache->SetAssoc);
+        uint64_t victim = (lines[k] & LINE_TAG_MASK) * (uint64_t)cache->NumCacheSets + j;
+        FindDirectoryEntry(shard, victim, 0)->Sharers &= ~me;
+        if (lines[k] & LINE_DIRTY) {
+            cache->Counters.DirtyEvictions++;
+            cache->Counters.WritebackBytes += cache->BlockSize;
+            setcounters->DirtyEvictions++;
+            setcounters->WritebackBytes += cache->BlockSize;
+        }
+    }
+    DirectoryEntry *e = FindDirectoryEntry(shard, block, 1);
+    if (e->Invalidated & me) {
+        coherence->CoherenceMisses++;
+        if (e->WrittenWords & wordbit) {
+            coherence->TrueSharingMisses++;
+        }
+        else {
+            coherence->FalseSharingMisses++;
+        }
+        e->Invalidated &= ~me;
+    }
+    uint64_t others = e->Sharers & ~me;
+    if (others) {
+        coherence->CacheToCache++;
+    }
+    if (write) {
+        if (others) {
+            InvalidateSharers(shard, e, j, tag, others, c);
+        }
+        WriteOwnership(e, c, wordbit);
+    }
+    else {
+        for (uint64_t left = others; left; left &= left - 1) {
+            int o = __builtin_ctzll(left);
+            CacheState *other = &shard->cores[o];
+            uint64_t *otherlines = &other->lines[(size_t)j * other->LineStride];
+            int otherempty;
+            int m = ProbeSet(otherlines, other->SetAssoc, tag, &otherempty);
+            if (m >= 0 && (otherlines[m] & LINE_DIRTY)) {
+                otherlines[m] &= ~LINE_DIRTY;
+                other->Counters.WritebackBytes += other->BlockSize;
+                other->SetCounters[j].WritebackBytes += other->BlockSize;
+            }
+        }
+    }
+    e->Sharers |= me;
+    cache->Counters.FillBytes += cache->BlockSize;
+    setcounters->FillBytes += cache->BlockSize;
+    lines[k] = LINE_VALID | tag | (write ? LINE_DIRTY : 0);
+    cache->Policy->Fill(replacement, cache->SetAssoc, k);
+}
+
+/*thread function of the multi-core engine, simulates its sets of every batch*/
+static void* CoreShardThread(void *arg) {
+    CoreShard *shard = (CoreShard*)arg;
+    CoreBatches *batches = shard->batches;
+    for (int b = 0; ; b ^= 1) {
+        pthread_barrier_wait(&batches->barrier);
+        int n = batches->count[b];
+        if (n == 0) {
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            AccessCore(shard, &batches->refs[b][i]);
+        }
+    }
+    return NULL;
+}
+
+//reads the next batch, returns -1 if a reference names a core that does not exist
+static int ReadCoreBatch(TraceReader *reader, FileContents *refs, int numCores) {
+    int n = ReadReferenceBlock(reader, refs, TRACE_BLOCK_SIZE);
+    for (int i = 0; i < n; i++) {
+        if (refs[i].Core < 0 || refs[i].Core >= numCores) {
+            printf("CORE %d OF MEMORY REFERENCE %lld IS OUT OF RANGE\n", refs[i].Core, reader->ReferencesRead - n + i + 1);
+            return -1;
+        }
+    }
+    return n;
+}
+
+/*This function simulates a private cache per core, built from userinput, kept coherent
+with MESI, then prints the counters of every core, the coherence misses split into true
+and false sharing, and the blocks whose write ownership moved between cores most often.
+The references are read in batches; with several threads the sets are split between
+them and each batch is simulated by all of them while the next one is read. Returns 0
+on success*/
+static int SimulateMultiCore(TraceReader *reader, Memory *userinput, RunOptions *options) {
+    int numCores = options->Cores;
+    Size *BytesAndBits = CalculateSize(userinput);
+    CacheState **caches = (CacheState**)calloc(numCores, sizeof(CacheState*));
+    for (int c = 0; c < numCores; c++) {
+        caches[c] = InitializeCache(userinput, BytesAndBits);
+        if (!caches[c]) {
+            for (int d = 0; d < c; d++) {
+                FreeCache(caches[d]);
+            }
+            free(caches);
+            free(BytesAndBits);
+            return -1;
+        }
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int numShards = options->Threads > 1 ? options->Threads : 1;
+    if (numShards > caches[0]->NumCacheSets) {
+        numShards = caches[0]->NumCacheSets;
+    }
+    CoreBatches batches;
+    batches.refs[0] = (FileContents*)malloc(sizeof(FileContents) * TRACE_BLOCK_SIZE);
+    batches.refs[1] = (FileContents*)malloc(sizeof(FileContents) * TRACE_BLOCK_SIZE);
+    CoreShard *shards = (CoreShard*)calloc(numShards, sizeof(CoreShard));
+    for (int t = 0; t < numShards; t++) {
+        CoreShard *shard = &shards[t];
+        shard->NumCores = numCores;
+        shard->cores = (CacheState*)malloc(sizeof(CacheState) * numCores);
+        shard->counters = (CoherenceCounters*)calloc(numCores, sizeof(CoherenceCounters));
+        for (int c = 0; c < numCores; c++) {
+            CacheState *state = &shard->cores[c];
+            *state = *caches[c];
+            state->FirstSet = (int)((long long)state->NumCacheSets * t / numShards);
+            state->EndSet = (int)((long long)state->NumCacheSets * (t + 1) / numShards);
+        }
+        InitBlockTable(&shard->index, 1 << 12);
+        shard->WordSize = userinput->WordSize > 0 ? userinput->WordSize : 1;
+        shard->WordsPerBlock = (userinput->CacheBlockSize + shard->WordSize - 1) / shard->WordSize;
+        shard->batches = &batches;
+    }
+    int status = 0;
+    if (numShards == 1) {
+        int n;
+        while ((n = ReadCoreBatch(reader, batches.refs[0], numCores)) > 0) {
+            for (int i = 0; i < n; i++) {
+                AccessCore(&shards[0], &batches.refs[0][i]);
+            }
+        }
+        status = n < 0 ? -1 : 0;
+    }
+    else {
+        pthread_barrier_init(&batches.barrier, NULL, numShards + 1);
+        pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * numShards);
+        for (int t = 0; t < numShards; t++) {
+            pthread_create(&threads[t], NULL, CoreShardThread, &shards[t]);
+        }
+        //hand batch b to the threads, then read the next one into the other buffer
+        int b = 0;
+        int n = ReadCoreBatch(reader, batches.refs[b], numCores);
+        for (;;) {
+            batches.count[b] = n > 0 ? n : 0;
+            pthread_barrier_wait(&batches.barrier);
+            if (n <= 0) {
+                break;
+            }
+            b ^= 1;
+            n = ReadCoreBatch(reader, batches.refs[b], numCores);
+        }
+        status = n < 0 ? -1 : 0;
+        for (int t = 0; t < numShards; t++) {
+            pthread_join(threads[t], NULL);
+        }
+        pthread_barrier_destroy(&batches.barrier);
+        free(threads);
+    }
+    double seconds = ElapsedSeconds(&start);
+    if (status != 0) {
+        for (int t = 0; t < numShards; t++) {
+            free(shards[t].cores);
+            free(shards[t].counters);
+            free(shards[t].entries);
+            FreeBlockTable(&shards[t].index);
+        }
+        for (int c = 0; c < numCores; c++) {
+            FreeCache(caches[c]);
+        }
+        free(shards);
+        free(caches);
+        free(batches.refs[0]);
+        free(batches.refs[1]);
+        free(BytesAndBits);
+        return status;
+    }
+
+    //merge the threads, every counter of a core is a sum over the threads
+    CoherenceCounters *counters = (CoherenceCounters*)calloc(numCores, sizeof(CoherenceCounters));
+    CoherenceCounters total;
+    CacheState all;
+    memset(&total, 0, sizeof(total));
+    memset(&all, 0, sizeof(all));
+    long long pingpongs = 0;
+    DirectoryEntry top[PINGPONG_HOTSPOTS];
+    int found = 0;
+    for (int t = 0; t < numShards; t++) {
+        CoreShard *shard = &shards[t];
+        for (int c = 0; c < numCores; c++) {
+            caches[c]->ActualHits += shard->cores[c].ActualHits;
+            caches[c]->NumberofMemoryReferences += shard->cores[c].NumberofMemoryReferences;
+            AddCacheCounters(&caches[c]->Counters, &shard->cores[c].Counters);
+            long long *from = (long long*)&shard->counters[c];
+            long long *into = (long long*)&counters[c];
+            for (size_t i = 0; i < sizeof(CoherenceCounters) / sizeof(long long); i++) {
+                into[i] += from[i];
+            }
+        }
+        //keep the PINGPONG_HOTSPOTS blocks with the most ping-pongs, sorted by insertion
+        for (int i = 0; i < shard->NumEntries; i++) {
+            DirectoryEntry *e = &shard->entries[i];
+            pingpongs += e->PingPongs;
+            if (e->PingPongs == 0 || (found == PINGPONG_HOTSPOTS && !MorePingPongs(e, &top[found - 1]))) {
+                continue;
+            }
+            int at = found < PINGPONG_HOTSPOTS ? found++ : found - 1;
+            while (at > 0 && MorePingPongs(e, &top[at - 1])) {
+                top[at] = top[at - 1];
+                at--;
+            }
+            top[at] = *e;
+        }
+    }
+    printf("\nMULTI-CORE (%d cores with private caches, MESI directory", numCores);
+    if (numShards > 1) {
+        printf(", sets split between %d threads", numShards);
+    }
+    printf("):\n");
+    printf("core\treferences\thit rate\tcoherence misses\tinvalidations received\n");
+    printf("______________________________________________________________________________________\n");
+    for (int c = 0; c < numCores; c++) {
+        CacheState *state = caches[c];
+        long long refs = state->NumberofMemoryReferences;
+        printf(" %d\t%lld\t\t%.2f%%\t\t%lld\t\t\t%lld\n", c, refs, refs ? 100.0 * state->ActualHits / refs : 0.0,
+               counters[c].CoherenceMisses, counters[c].InvalidationsReceived);
+        all.ActualHits += state->ActualHits;
+        all.NumberofMemoryReferences += refs;
+        AddCacheCounters(&all.Counters, &state->Counters);
+        long long *from = (long long*)&counters[c];
+        long long *into = (long long*)&total;
+        for (size_t i = 0; i < sizeof(CoherenceCounters) / sizeof(long long); i++) {
+            into[i] += from[i];
+        }
+    }
+    long long refs = all.NumberofMemoryReferences;
+    long long misses = refs - all.ActualHits;
+    CacheCounters *c = &all.Counters;
+    printf("\nAll cores: Hit Rate = %lld/%lld = %.2f%%\n", all.ActualHits, refs, refs ? 100.0 * all.ActualHits / refs : 0.0);
+    printf("Reads: %lld hits, %lld misses\n", c->ReadHits, c->ReadMisses);
+    printf("Writes: %lld hits, %lld misses\n", c->WriteHits, c->WriteMisses);
+    printf("Coherence misses = %lld (%.2f%% of misses): true sharing %lld, false sharing %lld\n", total.CoherenceMisses,
+           misses ? 100.0 * total.CoherenceMisses / misses : 0.0, total.TrueSharingMisses, total.FalseSharingMisses);
+    printf("Invalidations = %lld (%lld upgrades of shared blocks), cache-to-cache transfers = %lld\n",
+           total.InvalidationsSent, total.Upgrades, total.CacheToCache);
+    printf("Memory traffic = %lld bytes (fills %lld, write-backs %lld), dirty evictions = %lld\n",
+           c->FillBytes + c->WritebackBytes, c->FillBytes, c->WritebackBytes, c->DirtyEvictions);
+    printf("Ping-pongs (write ownership moving to another core) = %lld\n", pingpongs);
+    if (found > 0) {
+        printf("Blocks with the most ping-pongs:\n");
+        printf("mm blk#\t\taddress\t\tping-pongs\tcores holding it at the end\n");
+        printf("______________________________________________________________________________________\n");
+        for (int i = 0; i < found; i++) {
+            printf(" %llu\t\t0x%llx\t%lld\t\t%d\n", (unsigned long long)top[i].Block,
+                   (unsigned long long)(top[i].Block * (uint64_t)userinput->CacheBlockSize), top[i].PingPongs,
+                   __builtin_popcountll(top[i].Sharers));
+        }
+    }
+    printf("Simulated %lld memory references in %.3f s\n", refs, seconds);
+
+    for (int t = 0; t < numShards; t++) {
+        free(shards[t].cores);
+        free(shards[t].counters);
+        free(shards[t].entries);
+        FreeBlockTable(&shards[t].index);
+    }
+    for (int c = 0; c < numCores; c++) {
+        FreeCache(caches[c]);
+    }
+    free(shards);
+    free(caches);
+    free(counters);
+    free(batches.refs[0]);
+    free(batches.refs[1]);
+    free(BytesAndBits);
+    return status;
+}
+
+/*names of the synthetic patterns, indexed by GEN_SEQUENTIAL ... GEN_MIXED*/
+static const char *GeneratorNames[] = {"seq", "stride", "uniform", "zipf", "chase", "mixed"};
+
+/*returns the pattern called name, or -1*/
+static int FindGeneratorPattern(const char *name) {
+    for (int i = 0; i < GEN_PATTERNS; i++) {
+        if (strcmp(name, GeneratorNames[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+//uniform double in [0, 1)
+static inline double NextUniform(uint64_t *rng) {
+    return (double)(NextRandom(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*This function sets up a generator for config. Zipfian items are drawn with the
+method of Gray et al. ("Quickly generating billion-record synthetic databases"),
+which needs the generalized harmonic number of the item count once and then costs
+one pow per reference, and the item numbers are scrambled by a multiplicative hash
+so the hot items are spread over the sets. The pointer chase follows one random
+cycle through every item (Sattolo's shuffle), so each reference depends on the last*/
+static TraceGenerator* NewTraceGenerator(GeneratorConfig *config) {
+    TraceGenerator *g = (TraceGenerator*)calloc(1, sizeof(TraceGenerator));
+    g->config = *config;
+    g->Remaining = config->References;
+    uint64_t x = config->Seed * 0x9e3779b97f4a7c15ULL + 0x632be59bd9b4e019ULL;
+    g->rng = (x ^ (x >> 29)) | 1;
+    g->Items = (uint64_t)(config->Footprint / GEN_ITEM_SIZE);
+    g->StridePosition = config->Footprint / 2;//keeps the strided stream of a mixed trace away from the sequential one
+    int pattern = config->Pattern;
+    if (pattern == GEN_ZIPF || pattern == GEN_MIXED) {
+        double theta = config->ZipfExponent;
+        double zetan = 0;
+        for (uint64_t i = 1; i <= g->Items; i++) {
+            zetan += 1.0 / pow((double)i, theta);
+        }
+        double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+        g->ZipfZetaN = zetan;
+        g->ZipfAlpha = 1.0 / (1.0 - theta);
+        g->ZipfEta = (1.0 - pow(2.0 / (double)g->Items, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+        g->ZipfHalfPow = 1.0 + pow(0.5, theta);
+    }
+    if (pattern == GEN_CHASE || pattern == GEN_MIXED) {
+        g->Chain = (uint32_t*)malloc(sizeof(uint32_t) * g->Items);
+        for (uint64_t i = 0; i < g->Items; i++) {
+            g->Chain[i] = (uint32_t)i;
+        }
+        for (uint64_t i = g->Items - 1; i > 0; i--) {
+            uint64_t j = NextRandom(&g->rng) % i;
+            uint32_t t = g->Chain[i];
+            g->Chain[i] = g->Chain[j];
+            g->Chain[j] = t;
+        }
+    }
+    return g;
+}
+
+static void FreeTraceGenerator(TraceGenerator *g) {
+    free(g->Chain);
+    free(g);
+}
+
+//next address of one pattern
+static inline uint64_t GenerateAddress(TraceGenerator *g, int pattern) {
+    uint64_t footprint = (uint64_t)g->config.Footprint;
+    uint64_t address;
+    switch (pattern) {
+    case GEN_SEQUENTIAL:
+        address = g->Position;
+        g->Position = g->Position + GEN_WORD_SIZE < footprint ? g->Position + GEN_WORD_SIZE : 0;
+        return address;
+    case GEN_STRIDED:
+        address = g->StridePosition;
+        g->StridePosition = (g->StridePosition + (uint64_t)g->config.Stride) % footprint;
+        return address;
+    case GEN_UNIFORM:
+        return NextRandom(&g->rng) % (footprint / GEN_WORD_SIZE) * GEN_WORD_SIZE;
+    case GEN_ZIPF: {
+        double u = NextUniform(&g->rng);
+        double uz = u * g->ZipfZetaN;
+        uint64_t item;
+        if (uz < 1.0) {
+            item = 0;
+        }
+        else if (uz < g->ZipfHalfPow) {
+            item = 1;
+        }
+        else {
+            item = (uint64_t)((double)g->Items * pow(g->ZipfEta * u - g->ZipfEta + 1.0, g->ZipfAlpha));
+        }
+        item = (item * 0x9e3779b97f4a7c15ULL + 0x7f4a7c15ULL) % g->Items;
+        return item * GEN_ITEM_SIZE;
+    }
+    default://GEN_CHASE
+        g->ChaseNode = g->Chain[g->ChaseNode];
+        return (uint64_t)g->ChaseNode * GEN_ITEM_SIZE;
+    }
+}
+
+/*This function fills block with up to max generated references and returns how many,
+0 once the trace is over. A mixed trace draws each reference from the zipfian (40%),
+sequential (30%), strided (15%) or pointer chasing (15%) stream*/
+static int NextGeneratedBlock(TraceGenerator *g, FileContents *block, int max) {
+    int n = g->Remaining < max ? (int)g->Remaining : max;
+    int pattern = g->config.Pattern;
+    int writes = g->config.WritePercent;
+    for (int i = 0; i < n; i++) {
+        int p = pattern;
+        if (pattern == GEN_MIXED) {
+            uint64_t pick = NextRandom(&g->rng) % 100;
+            p = pick < 40 ? GEN_ZIPF : pick < 70 ? GEN_SEQUENTIAL : pick < 85 ? GEN_STRIDED : GEN_CHASE;
+        }
+        block[i].Address = GenerateAddress(g, p);
+        block[i].ReadOrWrite = writes > 0 && (int)(NextRandom(&g->rng) % 100) < writes;
+        block[i].Core = 0;
+    }
+    g->Remaining -= n;
+    return n;
+}
+
+/*This function writes a generated trace to a binary memory reference file, returns 0 on success*/
+static int GenerateTraceFile(GeneratorConfig *config, char *filename) {
+    FILE *out = fopen(filename, "wb");
+    if (!out) {
+        printf("COULD NOT CREATE %s\n", filename);
+        return -1;
+    }
+    TraceGenerator *g = NewTraceGenerator(config);
+    unsigned char header[BINARY_TRACE_HEADER_SIZE] = {0};
+    memcpy(header, BINARY_TRACE_MAGIC, 4);
+    header[4] = BINARY_TRACE_VERSION;
+    header[5] = config->Footprint > (1LL << 32) ? 64 : 32;
+    for (int i = 0; i < 8; i++) {
+        header[8 + i] = (unsigned char)(config->References >> (8 * i));
+    }
+    fwrite(header, 1, BINARY_TRACE_HEADER_SIZE, out);
+    unsigned char *buffer = (unsigned char*)malloc(TRACE_CHUNK_SIZE);
+    FileContents *refs = (FileContents*)malloc(sizeof(FileContents) * TRACE_BLOCK_SIZE);
+    size_t used = 0;
+    int64_t previous = 0;
+    int n;
+    while ((n = NextGeneratedBlock(g, refs, TRACE_BLOCK_SIZE)) > 0) {
+        for (int i = 0; i < n; i++) {
+            WriteBinaryReference(out, buffer, &used, &refs[i], &previous, 0);
+        }
+    }
+    fwrite(buffer, 1, used, out);
+    int status = ferror(out) ? -1 : 0;
+    fclose(out);
+    free(buffer);
+    free(refs);
+    FreeTraceGenerator(g);
+    if (status != 0) {
+        printf("COULD NOT WRITE %s\n", filename);
+        return -1;
+    }
+    printf("Generated %lld %s memory references in %s\n", config->References, GeneratorNames[config->Pattern], filename);
+    return 0;
+}
+
+/*starts a new peak resident set size measurement, Linux resets VmHWM when 5 is written to clear_refs*/
+static void ResetPeakResident(void) {
+    FILE *fp = fopen("/proc/self/clear_refs", "w");
+    if (fp) {
+        fputs("5", fp);
+        fclose(fp);
+    }
+}
+
+/*returns the peak resident set size in KiB since the last ResetPeakResident, or for
+the whole process when /proc cannot be read*/
+static long long PeakResidentKiB(void) {
+    long long kib = -1;
+    FILE *fp = fopen("/proc/self/status", "r");
+    if (fp) {
+        char line[256];
+        while (fgets(line, sizeof(line), fp)) {
+            if (strncmp(line, "VmHWM:", 6) == 0) {
+                kib = atoll(line + 6);
+                break;
+            }
+        }
+        fclose(fp);
+    }
+    if (kib < 0) {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        kib = usage.ru_maxrss;
+    }
+    return kib;
+}
+
+static int CompareDoubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/*parses a comma separated list of positive numbers into values, returns how many or -1*/
+static int ParseNumberList(const char *list, long long *values, int max) {
+    int count = 0;
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long long value = strtoll(p, &end, 10);
+        if (end == p || value <= 0 || count == max || (*end != ',' && *end != '\0')) {
+            return -1;
+        }
+        values[count++] = value;
+        p = *end ? end + 1 : end;
+    }
+    return count;
+}
+
+/*This function times the simulation loop on generated traces for every combination
+of pattern, replacement policy, associativity and cache size, repeat times each.
+The references are generated a block at a time and only the simulation of each block
+is timed, so the generators do not count, and an untimed run comes first. The median of the repeats is reported with
+the spread between the fastest and slowest repeat, and the hit rate is printed so a
+change in behavior is not mistaken for a change in speed. Returns 0 on success*/
+static int RunBenchmark(Memory *defaults, RunOptions *options) {
+    BenchConfig *bench = &options->Bench;
+    long long sizes[BENCH_MAX_LIST], assocs[BENCH_MAX_LIST];
+    int numSizes = ParseNumberList(bench->Sizes, sizes, BENCH_MAX_LIST);
+    int numAssocs = ParseNumberList(bench->Assocs, assocs, BENCH_MAX_LIST);
+    int patterns[GEN_PATTERNS];
+    int numPatterns = 0;
+    char list[sizeof(bench->Patterns)];
+    snprintf(list, sizeof(list), "%s", bench->Patterns);
+    for (char *name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+        int pattern = FindGeneratorPattern(name);
+        if (pattern < 0 || numPatterns == GEN_PATTERNS) {
+            printf("unknown pattern %s\n", name);
+            return -1;
+        }
+        patterns[numPatterns++] = pattern;
+    }
+    if (numSizes <= 0 || numAssocs <= 0 || numPatterns == 0) {
+        printf("invalid benchmark lists\n");
+        return -1;
+    }
+    for (const char *p = bench->Policies; *p; p++) {
+        if (!FindReplacementPolicy(*p)) {
+            printf("unknown replacement policy %c\n", *p);
+            return -1;
+        }
+    }
+    FILE *csv = NULL;
+    if (options->CSVFile[0]) {
+        csv = fopen(options->CSVFile, "w");
+        if (!csv) {
+            printf("COULD NOT CREATE %s\n", options->CSVFile);
+            return -1;
+        }
+        fprintf(csv, "pattern,policy,associativity,cache_size,block_size,references,refs_per_second,ns_per_reference,spread_percent,peak_rss_kib,hit_rate\n");
+    }
+    FileContents *refs = (FileContents*)malloc(sizeof(FileContents) * TRACE_BLOCK_SIZE);
+    double *times = (double*)malloc(sizeof(double) * bench->Repeat);
+    GeneratorConfig gen = options->Generator;
+    printf("%lld references per run, %lld byte footprint, seed %llu, %d%% writes, median of %d runs\n",
+           gen.References, gen.Footprint, (unsigned long long)gen.Seed, gen.WritePercent, bench->Repeat);
+    printf("pattern\tpolicy\tassoc\tcache size\tMrefs/s\tns/ref\tspread\tpeak RSS\thit rate\n");
+    printf("______________________________________________________________________________________\n");
+    int status = 0;
+    for (int pi = 0; pi < numPatterns && status == 0; pi++) {
+        gen.Pattern = patterns[pi];
+        for (const char *policy = bench->Policies; *policy && status == 0; policy++) {
+            for (int ai = 0; ai < numAssocs && status == 0; ai++) {
+                for (int si = 0; si < numSizes && status == 0; si++) {
+                    Memory config = *defaults;
+                    config.CacheSize = (int)sizes[si];
+                    config.SetAssoc = (int)assocs[ai];
+                    config.ReplacementPolicy[0] = *policy;
+                    config.MainMemorySize = gen.Footprint;
+                    if (config.SetAssoc > 65535 || config.CacheSize < config.CacheBlockSize * config.SetAssoc) {
+                        continue;
+                    }
+                    Size *BytesAndBits = CalculateSize(&config);
+                    ResetPeakResident();
+                    long long hits = 0, references = 0;
+                    //run -1 is not timed, it brings the clock speed up and faults in the allocator's pages
+                    for (int r = -1; r < bench->Repeat; r++) {
+                        CacheState *state = InitializeCache(&config, BytesAndBits);
+                        if (!state) {
+                            status = -1;
+                            break;
+                        }
+                        TraceGenerator *g = NewTraceGenerator(&gen);
+                        double seconds = 0;
+                        int n;
+                        while ((n = NextGeneratedBlock(g, refs, TRACE_BLOCK_SIZE)) > 0) {
+                            struct timespec start;
+                            clock_gettime(CLOCK_MONOTONIC, &start);
+                            SimulateReferences(state, refs, n);
+                            seconds += ElapsedSeconds(&start);
+                        }
+                        if (r >= 0) {
+                            times[r] = seconds;
+                        }
+                        hits = state->ActualHits;
+                        references = state->NumberofMemoryReferences;
+                        FreeTraceGenerator(g);
+                        FreeCache(state);
+                    }
+                    free(BytesAndBits);
+                    if (status != 0) {
+                        break;
+                    }
+                    qsort(times, bench->Repeat, sizeof(double), CompareDoubles);
+                    double median = times[bench->Repeat / 2];
+                    double nsPerRef = references ? median * 1e9 / references : 0.0;
+                    double rate = median > 0 ? references / median : 0.0;
+                    double spread = median > 0 ? 100.0 * (times[bench->Repeat - 1] - times[0]) / median : 0.0;
+                    long long rss = PeakResidentKiB();
+                    double hitrate = references ? 100.0 * hits / references : 0.0;
+                    printf("%s\t%c\t%d\t%d\t\t%.2f\t%.2f\t%.1f%%\t%.1f MiB\t%.2f%%\n", GeneratorNames[gen.Pattern], *policy,
+                           config.SetAssoc, config.CacheSize, rate / 1e6, nsPerRef, spread, rss / 1024.0, hitrate);
+                    if (csv) {
+                        fprintf(csv, "%s,%c,%d,%d,%d,%lld,%.0f,%.3f,%.2f,%lld,%.4f\n", GeneratorNames[gen.Pattern], *policy,
+                                config.SetAssoc, config.CacheSize, config.CacheBlockSize, references, rate, nsPerRef, spread, rss, hitrate);
+                    }
+                }
+            }
+        }
+    }
+    if (csv) {
+        fclose(csv);
+    }
+    free(times);
+    free(refs);
+    return status;
+}
+
+//drops the block of address from the cache, as an invalidation from another cache would
+static void InvalidateAddress(CacheState *state, uint64_t address) {
+    int j;
+    uint64_t tag;
+    DecomposeAddress(state, address, &j, &tag);
+    uint64_t *lines = &state->lines[(size_t)j * state->LineStride];
+    int empty;
+    int k = ProbeSet(lines, state->SetAssoc, tag & LINE_TAG_MASK, &empty);
+    if (k >= 0) {
+        lines[k] = 0;
+    }
+}
+
+/*This function runs random references through LRU and FIFO caches of 1 to
+SELF_TEST_MAX_WAYS ways and several set counts, once through the simulation kernels
+and once a reference at a time, and compares the hits with a plain model that keeps
+a time per way, of the last use for LRU and of the fill for FIFO. One reference in
+16 instead invalidates its block, as coherence and back-invalidation do, so ways are
+refilled out of turn. Returns 0 when every cache agrees with the model*/
+static int RunSelfTest(void) {
+    static const int setCounts[] = {1, 4, 16, 64};
+    FileContents *refs = (FileContents*)malloc(sizeof(FileContents) * SELF_TEST_REFERENCES);
+    uint64_t *tags = (uint64_t*)malloc(sizeof(uint64_t) * 64 * SELF_TEST_MAX_WAYS);
+    long long *lastUse = (long long*)malloc(sizeof(long long) * 64 * SELF_TEST_MAX_WAYS);
+    int failures = 0;
+    for (const char *policy = "LF"; *policy; policy++) {
+        for (int ways = 1; ways <= SELF_TEST_MAX_WAYS; ways++) {
+            for (size_t s = 0; s < sizeof(setCounts) / sizeof(setCounts[0]); s++) {
+                int sets = setCounts[s];
+                int blockSize = 16;
+                Memory config = {(long long)1 << 32, blockSize * ways * sets, blockSize, ways, {*policy, '\0'}, "B",
+                                 DEFAULT_HIT_LATENCY, DEFAULT_MISS_PENALTY, DEFAULT_WORD_SIZE};
+                //four times the cache, so there are hits, misses and every way gets replaced
+                uint64_t footprint = (uint64_t)config.CacheSize * 4;
+                uint64_t x = 0x9e3779b97f4a7c15ULL ^ (uint64_t)(ways * 131 + sets);
+                for (int i = 0; i < SELF_TEST_REFERENCES; i++) {
+                    x ^= x << 13;
+                    x ^= x >> 7;
+                    x ^= x << 17;
+                    refs[i].Address = x % footprint;
+                    refs[i].ReadOrWrite = (x >> 40) & 1;
+                    refs[i].Core = ((x >> 44) & 15) == 0;//1 to invalidate the block instead
+                    refs[i].NumberofMemoryReferences = 0;
+                }
+                long long expected = 0;
+                memset(tags, 0xff, sizeof(uint64_t) * sets * ways);
+                memset(lastUse, 0, sizeof(long long) * sets * ways);
+                for (int i = 0; i < SELF_TEST_REFERENCES; i++) {
+                    uint64_t block = refs[i].Address / blockSize;
+                    uint64_t *setTags = &tags[(block % sets) * ways];
+                    long long *setUse = &lastUse[(block % sets) * ways];
+                    int way = -1;
+                    int hit = 0;
+                    //the block's way, else an empty way, else the one with the oldest time
+                    for (int w = 0; w < ways; w++) {
+                        if (setTags[w] == block) {
+                            hit = 1;
+                            way = w;
+                            break;
+                        }
+                        if (way < 0 || (setTags[way] != UINT64_MAX &&
+                                        (setTags[w] == UINT64_MAX || setUse[w] < setUse[way]))) {
+                            way = w;
+                        }
+                    }
+                    if (refs[i].Core) {
+                        if (hit) {
+                            setTags[way] = UINT64_MAX;
+                        }
+                        continue;
+                    }
+                    expected += hit;
+                    //FIFO only takes the time of the fill
+                    if (!hit || *policy == 'L') {
+                        setTags[way] = block;
+                        setUse[way] = i + 1;
+                    }
+                }
+                Size *BytesAndBits = CalculateSize(&config);
+                CacheState *kernel = InitializeCache(&config, BytesAndBits);
+                CacheState *single = InitializeCache(&config, BytesAndBits);
+                int from = 0;
+                for (int i = 0; i < SELF_TEST_REFERENCES; i++) {
+                    if (refs[i].Core) {
+                        SimulateReferences(kernel, &refs[from], i - from);
+                        from = i + 1;
+                        InvalidateAddress(kernel, refs[i].Address);
+                        InvalidateAddress(single, refs[i].Address);
+                    }
+                    else {
+                        AccessAddress(single, refs[i].Address, refs[i].ReadOrWrite);
+                    }
+                }
+                SimulateReferences(kernel, &refs[from], SELF_TEST_REFERENCES - from);
+                if (kernel->ActualHits != expected || single->ActualHits != expected) {
+                    printf("%s, %d ways, %d sets: %lld hits (kernel), %lld hits (one at a time), %lld hits expected\n",
+                           kernel->Policy->Name, ways, sets, kernel->ActualHits, single->ActualHits, expected);
+                    failures++;
+                }
+                FreeCache(kernel);
+                FreeCache(single);
+                free(BytesAndBits);
+            }
+        }
+    }
+    free(refs);
+    free(tags);
+    free(lastUse);
+    printf("Self test %s: LRU and FIFO with 1 to %d ways against a reference model\n", failures ? "FAILED" : "passed", SELF_TEST_MAX_WAYS);
+    return failures ? -1 : 0;
+}
+
+/*struct behind the CacheSim handle of cachesim.h*/
+struct _cachesim {
+    Memory config;
+    Size *BytesAndBits;
+    CacheState *state;
+    FileContents *refs;//a batch converted for the simulation kernel
+};
+
+CacheSim* CacheSimCreate(const CacheSimConfig *config) {
+    if (!FindReplacementPolicy(config->ReplacementPolicy) || (config->WritePolicy != 'B' && config->WritePolicy != 'T') ||
+        config->BlockSize <= 0 || config->SetAssoc <= 0 || config->SetAssoc > 65535 ||
+        config->CacheSize < config->BlockSize * config->SetAssoc) {
+        return NULL;
+    }
+    CacheSim *sim = (CacheSim*)calloc(1, sizeof(CacheSim));
+    Memory *m = &sim->config;
+    m->MainMemorySize = config->MainMemorySize;
+    m->CacheSize = config->CacheSize;
+    m->CacheBlockSize = config->BlockSize;
+    m->SetAssoc = config->SetAssoc;
+    m->ReplacementPolicy[0] = config->ReplacementPolicy;
+    m->WritePolicy[0] = config->WritePolicy;
+    m->HitLatency = config->HitLatency > 0 ? config->HitLatency : DEFAULT_HIT_LATENCY;
+    m->MissPenalty = config->MissPenalty > 0 ? config->MissPenalty : DEFAULT_MISS_PENALTY;
+    m->WordSize = config->WordSize > 0 ? config->WordSize : DEFAULT_WORD_SIZE;
+    sim->BytesAndBits = CalculateSize(m);
+    sim->state = InitializeCache(m, sim->BytesAndBits);
+    if (!sim->state) {
+        free(sim->BytesAndBits);
+        free(sim);
+        return NULL;
+    }
+    sim->refs = (FileContents*)malloc(sizeof(FileContents) * TRACE_BLOCK_SIZE);
+    return sim;
+}
+
+int CacheSimAccess(CacheSim *sim, uint64_t address, int write) {
+    return AccessAddress(sim->state, address, write != 0);
+}
+
+/*the references go through the simulation kernel TRACE_BLOCK_SIZE at a time*/
+long long CacheSimAccessBatch(CacheSim *sim, const CacheSimReference *refs, size_t n) {
+    long long hits = sim->state->ActualHits;
+    for (size_t done = 0; done < n; ) {
+        int count = n - done < TRACE_BLOCK_SIZE ? (int)(n - done) : TRACE_BLOCK_SIZE;
+        for (int i = 0; i < count; i++) {
+            sim->refs[i].Address = refs[done + i].Address;
+            sim->refs[i].ReadOrWrite = refs[done + i].Write ? 1 : 0;
+            sim->refs[i].Core = 0;
+            sim->refs[i].NumberofMemoryReferences = 0;
+        }
+        SimulateReferences(sim->state, sim->refs, count);
+        done += count;
+    }
+    return sim->state->ActualHits - hits;
+}
+
+void CacheSimGetCounters(CacheSim *sim, CacheSimCounters *counters) {
+    CacheState *state = sim->state;
+    CacheCounters *c = &state->Counters;
+    counters->References = state->NumberofMemoryReferences;
+    counters->Hits = state->ActualHits;
+    counters->ReadHits = c->ReadHits;
+    counters->ReadMisses = c->ReadMisses;
+    counters->WriteHits = c->WriteHits;
+    counters->WriteMisses = c->WriteMisses;
+    counters->DirtyEvictions = c->DirtyEvictions;
+    counters->DirtyBlocks = CountDirtyBlocks(state);
+    counters->FillBytes = c->FillBytes;
+    counters->WritebackBytes = c->WritebackBytes;
+    counters->WriteThroughBytes = c->WriteThroughBytes;
+    counters->HitRate = state->NumberofMemoryReferences ? (double)state->ActualHits / state->NumberofMemoryReferences : 0.0;
+    counters->AverageAccessTime = AverageMemoryAccessTime(&sim->config, state->ActualHits, state->NumberofMemoryReferences);
+}
+
+void CacheSimResetCounters(CacheSim *sim) {
+    ResetCacheCounters(sim->state);
+}
+
+void CacheSimFree(CacheSim *sim) {
+    FreeCache(sim->state);
+    free(sim->BytesAndBits);
+    free(sim->refs);
+    free(sim);
+}
+
+/*prints the command line options*/
+static void PrintUsage(char *program) {
+    printf("usage: %s [options] <memory reference file>\n", program);
+    printf("  -m <bytes>   size of main memory\n");
+    printf("  -c <bytes>   size of the cache\n");
+    printf("  -b <bytes>   cache block/line size\n");
+    printf("  -a <n>       degree of set-associativity\n");
+    printf("  -r <policy>  replacement policy (L = LRU , F = FIFO , P = tree-PLRU , S = SRRIP ,\n");
+    printf("               B = BRRIP , U = LFU , R = random)\n");
+    printf("  -w <B|T>     write policy (B = write-back , T = write-through)\n");
+    printf("  --hit-latency <cycles>   hit time used for the average memory access time (default %d)\n", DEFAULT_HIT_LATENCY);
+    printf("  --miss-penalty <cycles>  extra cycles of a miss (default %d)\n", DEFAULT_MISS_PENALTY);
+    printf("  --word-size <bytes>      bytes sent to memory by each write-through write (default %d)\n", DEFAULT_WORD_SIZE);
+    printf("  --output <summary|sample|full>  summary prints the counters only (default), sample\n");
+    printf("               adds every Nth line of the main memory table, full prints the whole\n");
+    printf("               table and the final status of the cache\n");
+    printf("  --every <n>  line interval of --output sample (default 1000)\n");
+    printf("  --table      same as --output full\n");
+    printf("  --csv <file>     also write the results as CSV\n");
+    printf("  --results <file> also write the results in the binary result format\n");
+    printf("  --best       calculate the best possible hit rate of the same cache with Belady's\n");
+    printf("               MIN replacement (keeps every block number in memory)\n");
+    printf("  --sample <fraction>  simulate only this fraction of the sets (chosen at random) and\n");
+    printf("               estimate the whole cache with 95%% confidence intervals, also with --batch\n");
+    printf("  --validate   with --sample, also simulate every set and print the real error\n");
+    printf("  --classify   split the misses into compulsory, capacity and conflict misses with a\n");
+    printf("               fully associative LRU shadow cache and list the sets with the most conflicts\n");
+    printf("  --prefetch <next|stride|stream>  attach a next-line, stride (reference prediction table\n");
+    printf("               per 4 KiB region) or stream prefetcher to the cache\n");
+    printf("  --prefetch-degree <n>    blocks fetched each time the prefetcher triggers (default %d)\n", DEFAULT_PREFETCH_DEGREE);
+    printf("  --prefetch-distance <n>  how many blocks (strides) ahead the first one is (default %d)\n", DEFAULT_PREFETCH_DISTANCE);
+    printf("  --save <file>    write a snapshot of the whole cache state at the end of the run\n");
+    printf("  --save-at <n>    write it after the first n memory references instead\n");
+    printf("  --save-every <n> write a snapshot every n memory references, named <file>.<n>\n");
+    printf("  --load <file>    start from a snapshot and continue after the memory reference it was taken at\n");
+    printf("  --reset-counters after --load, only count the memory references that follow\n");
+    printf("  --length <n>     stop after simulating n memory references\n");
+    printf("  --sweep      one pass LRU hit rates for every power of two cache size up to -c and\n");
+    printf("               every associativity up to -a at the block size given by -b\n");
+    printf("  --l2 <size>,<block>,<assoc>[,<replacement>[,<write>[,<hit latency>]]]\n");
+    printf("  --l3 <size>,<block>,<assoc>[,<replacement>[,<write>[,<hit latency>]]]\n");
+    printf("               simulate a hierarchy with the cache above as L1 and these levels below\n");
+    printf("               it (hit latencies default to %d and %d cycles)\n", DEFAULT_L2_HIT_LATENCY, DEFAULT_L3_HIT_LATENCY);
+    printf("  --inclusion <nine|inclusive|exclusive>  inclusion policy of the hierarchy (default nine)\n");
+    printf("  --batch <file>  simulate every configuration listed in file, one per line:\n");
+    printf("               <cache size> <block size> <associativity> <replacement> <write>\n");
+    printf("  --threads <n>   number of threads used by --batch (default: one per core), without\n");
+    printf("               --batch the sets of the cache are split between n threads, a NINE\n");
+    printf("               hierarchy runs one thread per level unless n is 1\n");
+    printf("  --cores <n>  give each of n cores (at most %d) a private copy of the cache and keep them\n", MAX_CORES);
+    printf("               coherent with MESI, each memory reference names its core after the address\n");
+    printf("               (core 0 when it does not), --threads splits the sets between threads\n");
+    printf("  --self-test  check the LRU and FIFO policies against a reference model and exit\n");
+    printf("  --bench      time the simulation of generated traces for every combination of\n");
+    printf("               pattern, replacement policy, associativity and cache size, no file needed\n");
+    printf("  --bench-patterns <list>  patterns to time (default %s)\n", DEFAULT_BENCH_PATTERNS);
+    printf("  --bench-policies <codes> replacement policies to time, e.g. LFP (default %s)\n", DEFAULT_BENCH_POLICIES);
+    printf("  --bench-assoc <list>     associativities to time (default %s)\n", DEFAULT_BENCH_ASSOC);
+    printf("  --bench-sizes <list>     cache sizes to time (default %s), -b sets the block size\n", DEFAULT_BENCH_SIZES);
+    printf("  --bench-repeat <n>       runs of each combination, the median is reported (default %d)\n", DEFAULT_BENCH_REPEAT);
+    printf("  --generate <pattern>     write a generated trace to the memory reference file instead\n");
+    printf("               of simulating it, patterns: seq, stride, uniform, zipf, chase, mixed\n");
+    printf("  --refs <n>       references per generated trace (default %d)\n", DEFAULT_GEN_REFERENCES);
+    printf("  --footprint <bytes>  memory the generated addresses fall in (default %lld)\n", DEFAULT_GEN_FOOTPRINT);
+    printf("  --seed <n>       seed of the generators (default 1)\n");
+    printf("  --writes <percent>   share of generated references that are writes (default %d)\n", DEFAULT_GEN_WRITES);
+    printf("  --stride <bytes>     step of the stride pattern (default %d)\n", DEFAULT_GEN_STRIDE);
+    printf("  --zipf <exponent>    skew of the zipf pattern, between 0 and 1 (default %.2f)\n", DEFAULT_ZIPF_EXPONENT);
+    printf("  --tlb        translate every address through L1 and L2 TLBs (LRU) and walk a four level\n");
+    printf("               page table on a miss in both, reports misses per kilo-reference and walk cycles\n");
+    printf("  --page-size <4k|2m|1g>   size of every page (default 4k)\n");
+    printf("  --tlb-l1 <entries>,<assoc>  L1 TLB (default %d,%d)\n", DEFAULT_L1_TLB_ENTRIES, DEFAULT_L1_TLB_ASSOC);
+    printf("  --tlb-l2 <entries>,<assoc>[,<latency>]  L2 TLB and the cycles of each lookup (default %d,%d,%d, 0 for none)\n",
+           DEFAULT_L2_TLB_ENTRIES, DEFAULT_L2_TLB_ASSOC, DEFAULT_L2_TLB_LATENCY);
+    printf("  --pwc <entries>  page-walk cache entries per page table level (default %d, 0 for none)\n", DEFAULT_WALK_CACHE_ENTRIES);
+    printf("  --walk-latency <cycles>  cost of each page table read (default %d)\n", DEFAULT_WALK_LATENCY);
+    printf("  --tlb-inject     send the page table reads through the data cache instead\n");
+    printf("  --ring <name>    read the memory references live from a shared memory ring that a tracing\n");
+    printf("               process fills through cachesim.h, instead of from a file\n");
+    printf("  --ring-slots <n> references the ring holds, a power of two (default %d)\n", DEFAULT_TRACE_RING_SLOTS);
+    printf("the memory reference file can be text or binary, convert text files with\n");
+    printf("  %s --convert <text file> <binary file>\n", program);
+    printf("run without options to be prompted for each value\n");
+}
+
+/*This function reads the cache parameters from the command line, returns 0 on success*/
+static int ParseCommandLine(int argc, char *argv[], Memory *userinput, char *filename, RunOptions *options) {
+    //defaults used for anything not given on the command line
+    userinput->MainMemorySize = 65536;
+    userinput->CacheSize = 1024;
+    userinput->CacheBlockSize = 16;
+    userinput->SetAssoc = 1;
+    strcpy(userinput->ReplacementPolicy, "L");
+    strcpy(userinput->WritePolicy, "B");
+    userinput->HitLatency = DEFAULT_HIT_LATENCY;
+    userinput->MissPenalty = DEFAULT_MISS_PENALTY;
+    userinput->WordSize = DEFAULT_WORD_SIZE;
+    GeneratorConfig defaultGenerator = {GEN_SEQUENTIAL, DEFAULT_GEN_REFERENCES, DEFAULT_GEN_FOOTPRINT, 1, DEFAULT_GEN_WRITES,
+                                        DEFAULT_GEN_STRIDE, DEFAULT_ZIPF_EXPONENT};
+    options->Generator = defaultGenerator;
+    snprintf(options->Bench.Patterns, sizeof(options->Bench.Patterns), "%s", DEFAULT_BENCH_PATTERNS);
+    snprintf(options->Bench.Policies, sizeof(options->Bench.Policies), "%s", DEFAULT_BENCH_POLICIES);
+    snprintf(options->Bench.Assocs, sizeof(options->Bench.Assocs), "%s", DEFAULT_BENCH_ASSOC);
+    snprintf(options->Bench.Sizes, sizeof(options->Bench.Sizes), "%s", DEFAULT_BENCH_SIZES);
+    options->Bench.Repeat = DEFAULT_BENCH_REPEAT;
+    TlbConfig defaultTlb = {0, DEFAULT_PAGE_SHIFT, DEFAULT_L1_TLB_ENTRIES, DEFAULT_L1_TLB_ASSOC, DEFAULT_L2_TLB_ENTRIES,
+                            DEFAULT_L2_TLB_ASSOC, DEFAULT_L2_TLB_LATENCY, DEFAULT_WALK_CACHE_ENTRIES, DEFAULT_WALK_LATENCY, 0};
+    options->Tlb = defaultTlb;
+    filename[0] = '\0';
+    for (int i = 1; i < argc; i++) {
+        char *arg = argv[i];
+        char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--table") == 0) {
+            options->OutputMode = OUTPUT_FULL;
+        }
+        else if (strcmp(arg, "--output") == 0 || strcmp(arg, "--every") == 0 ||
+                 strcmp(arg, "--csv") == 0 || strcmp(arg, "--results") == 0) {
+            if (!value) {
+                printf("missing value for %s\n", arg);
+                return -1;
+            }
+            if (strcmp(arg, "--output") == 0) {
+                if (strcmp(value, "summary") == 0) {
+                    options->OutputMode = OUTPUT_SUMMARY;
+                }
+                else if (strcmp(value, "sample") == 0) {
+                    options->OutputMode = OUTPUT_SAMPLED;
+                }
+                else if (strcmp(value, "full") == 0) {
+                    options->OutputMode = OUTPUT_FULL;
+                }
+                else {
+                    printf("unknown output mode %s\n", value);
+                    return -1;
+                }
+            }
+            else if (strcmp(arg, "--every") == 0) {
+                options->Every = atoll(value);
+                if (options->Every <= 0) {
+                    printf("--every needs a positive number\n");
+                    return -1;
+                }
+                options->OutputMode = OUTPUT_SAMPLED;
+            }
+            else if (strcmp(arg, "--csv") == 0) {
+                snprintf(options->CSVFile, sizeof(options->CSVFile), "%s", value);
+            }
+            else {
+                snprintf(options->ResultFile, sizeof(options->ResultFile), "%s", value);
+            }
+            i++;
+        }
+        else if (strcmp(arg, "--sample") == 0) {
+            options->SampleFraction = value ? atof(value) : 0;
+            if (options->SampleFraction <= 0 || options->SampleFraction > 1) {
+                printf("--sample needs a fraction of the sets between 0 and 1\n");
+                return -1;
+            }
+            i++;
+        }
+        else if (strcmp(arg, "--validate") == 0) {
+            options->Validate = 1;
+        }
+        else if (strcmp(arg, "--classify") == 0) {
+            options->Classify = 1;
+        }
+        else if (strcmp(arg, "--prefetch") == 0) {
+            if (!value) {
+                printf("missing value for %s\n", arg);
+                return -1;
+            }
+            if (strcmp(value, "next") == 0) {
+                options->PrefetchKind = PREFETCH_NEXT_LINE;
+            }
+            else if (strcmp(value, "stride") == 0) {
+                options->PrefetchKind = PREFETCH_STRIDE;
+            }
+            else if (strcmp(value, "stream") == 0) {
+                options->PrefetchKind = PREFETCH_STREAM;
+            }
+            else {
+                printf("unknown prefetcher %s\n", value);
+                return -1;
+            }
+            i++;
+        }
+        else if (strcmp(arg, "--bench") == 0) {
+            options->Bench.Enabled = 1;
+        }
+        else if (strcmp(arg, "--self-test") == 0) {
+            options->SelfTest = 1;
+        }
+        else if (strcmp(arg, "--generate") == 0) {
+            options->Generator.Pattern = value ? FindGeneratorPattern(value) : -1;
+            if (options->Generator.Pattern < 0) {
+                printf("--generate needs a pattern: seq, stride, uniform, zipf, chase or mixed\n");
+                return -1;
+            }
+            options->Generate = 1;
+            i++;
+        }
+        else if (strcmp(arg, "--bench-patterns") == 0 || strcmp(arg, "--bench-policies") == 0 ||
+                 strcmp(arg, "--bench-assoc") == 0 || strcmp(arg, "--bench-sizes") == 0) {
+            if (!value) {
+                printf("missing value for %s\n", arg);
+                return -1;
+            }
+            BenchConfig *bench = &options->Bench;
+            if (strcmp(arg, "--bench-patterns") == 0) {
+                snprintf(bench->Patterns, sizeof(bench->Patterns), "%s", value);
+            }
+            else if (strcmp(arg, "--bench-policies") == 0) {
+                snprintf(bench->Policies, sizeof(bench->Policies), "%s", value);
+            }
+            else if (strcmp(arg, "--bench-assoc") == 0) {
+                snprintf(bench->Assocs, sizeof(bench->Assocs), "%s", value);
+            }
+            else {
+                snprintf(bench->Sizes, sizeof(bench->Sizes), "%s", value);
+            }
+            i++;
+        }
+        else if (strcmp(arg, "--refs") == 0 || strcmp(arg, "--footprint") == 0 || strcmp(arg, "--seed") == 0 ||
+                 strcmp(arg, "--writes") == 0 || strcmp(arg, "--stride") == 0 || strcmp(arg, "--bench-repeat") == 0) {
+            long long number = value ? atoll(value) : -1;
+            if (number < 0 || (number == 0 && strcmp(arg, "--seed") != 0 && strcmp(arg, "--writes") != 0)) {
+                printf("%s needs a positive number\n", arg);
+                return -1;
+            }
+            if (strcmp(arg, "--refs") == 0) {
+                options->Generator.References = number;
+            }
+            else if (strcmp(arg, "--footprint") == 0) {
+                options->Generator.Footprint = number;
+            }
+            else if (strcmp(arg, "--seed") == 0) {
+                options->Generator.Seed = (uint64_t)number;
+            }
+            else if (strcmp(arg, "--writes") == 0) {
+                options->Generator.WritePercent = (int)number;
+            }
+            else if (strcmp(arg, "--stride") == 0) {
+                options->Generator.Stride = number;
+            }
+            else {
+                options->Bench.Repeat = (int)number;
+            }
+            i++;
+        }
+        else if (strcmp(arg, "--zipf") == 0) {
+            options->Generator.ZipfExponent = value ? atof(value) : 0;
+            if (options->Generator.ZipfExponent <= 0 || options->Generator.ZipfExponent >= 1) {
+                printf("--zipf needs an exponent between 0 and 1\n");
+                return -1;
+            }
+            i++;
+        }
+        else if (strcmp(arg, "--tlb") == 0) {
+            options->Tlb.Enabled = 1;
+        }
+        else if (strcmp(arg, "--tlb-inject") == 0) {
+            options->Tlb.Enabled = 1;
+            options->Tlb.Inject = 1;
+        }
+        else if (strcmp(arg, "--tlb-l1") == 0 || strcmp(arg, "--tlb-l2") == 0) {
+            int entries = 0, assoc = 0, latency = DEFAULT_L2_TLB_LATENCY;
+            int count = value ? sscanf(value, "%d,%d,%d", &entries, &assoc, &latency) : 0;
+            int l2 = arg[7] == '2';
+            //--tlb-l2 0 leaves out the L2 TLB, only the L2 TLB takes a latency
+            if (!(l2 && count >= 1 && entries == 0) &&
+                (count < 2 || count > 2 + l2 || entries <= 0 || assoc <= 0 || assoc > 65535 || entries % assoc != 0)) {
+                printf("%s needs <entries>,<associativity>%s with the entries a multiple of the associativity\n",
+                       arg, l2 ? "[,<latency>]" : "");
+                return -1;
+            }
+            if (l2 && latency < 0) {
+                printf("the latency of --tlb-l2 cannot be negative\n");
+                return -1;
+            }
+            if (l2) {
+                options->Tlb.L2Entries = entries;
+                options->Tlb.L2Assoc = assoc;
+                options->Tlb.L2Latency = latency;
+            }
+            else {
+                options->Tlb.L1Entries = entries;
+                options->Tlb.L1Assoc = assoc;
+            }
+            options->Tlb.Enabled = 1;
+            i++;
+        }
+        else if (strcmp(arg, "--page-size") == 0) {
+            if (value && strcasecmp(value, "4k") == 0) {
+                options->Tlb.PageShift = 12;
+            }
+            else if (value && strcasecmp(value, "2m") == 0) {
+                options->Tlb.PageShift = 21;
+            }
+            else if (value && strcasecmp(value, "1g") == 0) {
+                options->Tlb.PageShift = 30;
+            }
+            else {
+                printf("--page-size needs 4k, 2m or 1g\n");
+                return -1;
+            }
+            options->Tlb.Enabled = 1;
+            i++;
+        }
+        else if (strcmp(arg, "--pwc") == 0 || strcmp(arg, "--walk-latency") == 0) {
+            int number = value ? atoi(value) : -1;
+            if (number < 0 || (value && (value[0] < '0' || value[0] > '9'))) {
+                printf("%s needs a number\n", arg);
+                return -1;
+            }
+            if (arg[2] == 'p') {
+                options->Tlb.WalkCacheEntries = number;
+            }
+            else {
+                options->Tlb.WalkLatency = number;
+            }
+            options->Tlb.Enabled = 1;
+            i++;
+        }
+        else if (strcmp(arg, "--ring") == 0) {
+            if (!value) {
+                printf("missing value for %s\n", arg);
+                return -1;
+            }
+            snprintf(options->RingName, sizeof(options->RingName), "%s", value);
+            i++;
+        }
+        else if (strcmp(arg, "--ring-slots") == 0) {
+            options->RingSlots = value ? atoll(value) : 0;
+            if (options->RingSlots < 1024 || (options->RingSlots & (options->RingSlots - 1)) != 0) {
+                printf("--ring-slots needs a power of two of at least 1024\n");
+                return -1;
+            }
+            i++;
+        }
+        else if (strcmp(arg, "--cores") == 0) {
+            options->Cores = value ? atoi(value) : 0;
+            if (options->Cores <= 0 || options->Cores > MAX_CORES) {
+                printf("--cores needs between 1 and %d cores\n", MAX_CORES);
+                return -1;
+            }
+            i++;
+        }
+        else if (strcmp(arg, "--prefetch-degree") == 0 || strcmp(arg, "--prefetch-distance") == 0) {
+            int number = value ? atoi(value) : 0;
+            if (number <= 0) {
+                printf("%s needs a positive number of blocks\n", arg);
+                return -1;
+            }
+            if (strcmp(arg, "--prefetch-degree") == 0) {
+                options->PrefetchDegree = number;
+            }
+            else {
+                options->PrefetchDistance = number;
+            }
+            i++;
+        }
+        else if (strcmp(arg, "--save") == 0 || strcmp(arg, "--load") == 0) {
+            if (!value) {
+                printf("missing value for %s\n", arg);
+                return -1;
+            }
+            snprintf(arg[2] == 's' ? options->SaveFile : options->LoadFile, 256, "%s", value);
+            i++;
+        }
+        else if (strcmp(arg, "--save-at") == 0 || strcmp(arg, "--save-every") == 0 || strcmp(arg, "--length") == 0) {
+            long long number = value ? atoll(value) : 0;
+            if (number <= 0) {
+                printf("%s needs a positive number of memory references\n", arg);
+                return -1;
+            }
+            if (strcmp(arg, "--save-at") == 0) {
+                options->SaveAt = number;
+            }
+            else if (strcmp(arg, "--save-every") == 0) {
+                options->SaveEvery = number;
+            }
+            else {
+                options->Length = number;
+            }
+            i++;
+        }
+        else if (strcmp(arg, "--reset-counters") == 0) {
+            options->ResetCounters = 1;
+        }
+        else if (strcmp(arg, "--best") == 0) {
+            options->BestHitRate = 1;
+        }
+        else if (strcmp(arg, "--sweep") == 0) {
+            options->Sweep = 1;
+        }
+        else if (strcmp(arg, "--hit-latency") == 0 || strcmp(arg, "--miss-penalty") == 0 ||
+                 strcmp(arg, "--word-size") == 0) {
+            if (!value) {
+                printf("missing value for %s\n", arg);
+                return -1;
+            }
+            int number = atoi(value);
+            if (number < 0) {
+                printf("%s needs a number of at least 0\n", arg);
+                return -1;
+            }
+            if (arg[2] == 'h') {
+                userinput->HitLatency = number;
+            }
+            else if (arg[2] == 'm') {
+                userinput->MissPenalty = number;
+            }
+            else {
+                userinput->WordSize = number;
+            }
+            i++;
+        }
+        else if (strcmp(arg, "--l2") == 0 || strcmp(arg, "--l3") == 0) {
+            int level = arg[3] - '2';
+            if (!value || ParseCacheLevel(value, &options->Levels[level], level == 0 ? DEFAULT_L2_HIT_LATENCY : DEFAULT_L3_HIT_LATENCY) != 0) {
+                printf("%s needs <cache size>,<block size>,<associativity>[,<replacement>[,<write>[,<hit latency>]]]\n", arg);
+                return -1;
+            }
+            if (options->NumLowerLevels < level + 1) {
+                options->NumLowerLevels = level + 1;
+            }
+            i++;
+        }
+        else if (strcmp(arg, "--inclusion") == 0) {
+            if (!value) {
+                printf("missing value for %s\n", arg);
+                return -1;
+            }
+            if (strcmp(value, "nine") == 0) {
+                options->Inclusion = INCLUSION_NINE;
+            }
+            else if (strcmp(value, "inclusive") == 0) {
+                options->Inclusion = INCLUSION_INCLUSIVE;
+            }
+            else if (strcmp(value, "exclusive") == 0) {
+                options->Inclusion = INCLUSION_EXCLUSIVE;
+            }
+            else {
+                printf("unknown inclusion policy %s\n", value);
+                return -1;
+            }
+            i++;
+        }
+        else if (strcmp(arg, "--batch") == 0 || strcmp(arg, "--threads") == 0) {
+            if (!value) {
+                printf("missing value for %s\n", arg);
+                return -1;
+            }
+            if (arg[2] == 'b') {
+                snprintf(options->BatchFile, sizeof(options->BatchFile), "%s", value);
+            }
+            else {
+                options->Threads = atoi(value);
+            }
+            i++;
+        }
+        else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            return -1;
+        }
+        else if (arg[0] == '-' && arg[1] != '\0' && arg[2] == '\0' && strchr("mcbarw", arg[1])) {
+            if (!value) {
+                printf("missing value for %s\n", arg);
+                return -1;
+            }
+            switch (arg[1]) {
+                case 'm': userinput->MainMemorySize = atoll(value); break;
+                case 'c': userinput->CacheSize = atoi(value); break;
+                case 'b': userinput->CacheBlockSize = atoi(value); break;
+                case 'a': userinput->SetAssoc = atoi(value); break;
+                case 'r': snprintf(userinput->ReplacementPolicy, 2, "%s", value); break;
+                case 'w': snprintf(userinput->WritePolicy, 2, "%s", value); break;
+            }
+            i++;
+        }
+        else if (arg[0] != '-' && filename[0] == '\0') {
+            snprintf(filename, 256, "%s", arg);
+        }
+        else {
+            printf("unknown option %s\n", arg);
+            return -1;
+        }
+    }
+    if (filename[0] == '\0' && !options->Bench.Enabled && !options->RingName[0] && !options->SelfTest) {
+        printf("no memory reference file given\n");
+        return -1;
+    }
+    //a live ring is read once from start to end, sharding the sets of one cache would need all of it first
+    if (options->RingName[0] && (filename[0] || options->BatchFile[0] || options->LoadFile[0] ||
+                                 options->Bench.Enabled || options->Generate ||
+                                 (options->Threads > 1 && options->Cores == 0 && options->NumLowerLevels == 0))) {
+        printf("--ring replaces the memory reference file and cannot be used with --batch, --load or a sharded cache\n");
+        return -1;
+    }
+    if (options->RingSlots > 0 && !options->RingName[0]) {
+        printf("--ring-slots needs --ring\n");
+        return -1;
+    }
+    if (options->RingSlots == 0) {
+        options->RingSlots = DEFAULT_TRACE_RING_SLOTS;
+    }
+    GeneratorConfig *generator = &options->Generator;
+    if (generator->WritePercent > 100 || generator->Footprint < 4096 ||
+        generator->Footprint / GEN_ITEM_SIZE > UINT32_MAX || generator->Stride >= generator->Footprint) {
+        printf("invalid trace generator settings\n");
+        return -1;
+    }
+    //the benchmark times the plain simulation loop of one cache at a time
+    if ((options->Bench.Enabled || options->Generate) &&
+        (options->Bench.Enabled == options->Generate || options->OutputMode != OUTPUT_SUMMARY ||
+         options->BestHitRate || options->Sweep || options->BatchFile[0] || options->NumLowerLevels > 0 ||
+         options->SampleFraction > 0 || options->Classify || options->PrefetchKind != PREFETCH_NONE ||
+         options->SaveFile[0] || options->LoadFile[0] || options->Length > 0)) {
+        printf("--bench and --generate cannot be combined with each other or with other modes\n");
+        return -1;
+    }
+    if (!FindReplacementPolicy(userinput->ReplacementPolicy[0])) {
+        printf("unknown replacement policy %s\n", userinput->ReplacementPolicy);
+        return -1;
+    }
+    if (userinput->CacheBlockSize <= 0 || userinput->SetAssoc <= 0 || userinput->SetAssoc > 65535 ||
+        userinput->CacheSize < userinput->CacheBlockSize * userinput->SetAssoc) {
+        printf("invalid cache geometry\n");
+        return -1;
+    }
+    if (options->SampleFraction > 0 && (options->OutputMode != OUTPUT_SUMMARY || options->BestHitRate ||
+                                        options->Sweep || options->NumLowerLevels > 0)) {
+        printf("--sample only works on a single cache with the summary output and without --best\n");
+        return -1;
+    }
+    int snapshots = options->SaveFile[0] || options->LoadFile[0];
+    if ((options->SaveAt > 0 || options->SaveEvery > 0) && !options->SaveFile[0]) {
+        printf("--save-at and --save-every need --save\n");
+        return -1;
+    }
+    if ((snapshots || options->Length > 0) && (options->SampleFraction > 0 || options->Sweep ||
+                                               options->BatchFile[0] || options->NumLowerLevels > 0)) {
+        printf("snapshots and --length only work on a single cache without --sample\n");
+        return -1;
+    }
+    if (options->LoadFile[0] && options->BestHitRate) {
+        printf("--best needs the whole trace from a cold cache and cannot be used with --load\n");
+        return -1;
+    }
+    if (options->Validate && (options->SampleFraction == 0 || options->BatchFile[0])) {
+        printf("--validate needs --sample and a single cache\n");
+        return -1;
+    }
+    //a warm start would count blocks the snapshot's cache already saw as compulsory misses
+    if (options->Classify && (options->SampleFraction > 0 || options->Sweep || options->BatchFile[0] ||
+                              options->NumLowerLevels > 0 || options->LoadFile[0])) {
+        printf("--classify only works on a single cache from a cold start without --sample\n");
+        return -1;
+    }
+    if ((options->PrefetchDegree > 0 || options->PrefetchDistance > 0) && options->PrefetchKind == PREFETCH_NONE) {
+        printf("--prefetch-degree and --prefetch-distance need --prefetch\n");
+        return -1;
+    }
+    //snapshots do not hold the prefetcher's tables and the shadow cache of --classify does not prefetch
+    if (options->PrefetchKind != PREFETCH_NONE && (options->SampleFraction > 0 || options->Sweep || options->BatchFile[0] ||
+                                                   options->NumLowerLevels > 0 || options->Classify ||
+                                                   options->SaveFile[0] || options->LoadFile[0])) {
+        printf("--prefetch only works on a single cache without --sample, --classify or snapshots\n");
+        return -1;
+    }
+    //the caches of the cores only keep the counters, and MESI needs write-back caches
+    if (options->Cores > 0 && (options->OutputMode != OUTPUT_SUMMARY || options->BestHitRate || options->Sweep ||
+                               options->BatchFile[0] || options->NumLowerLevels > 0 || options->SampleFraction > 0 ||
+                               options->Classify || options->PrefetchKind != PREFETCH_NONE || snapshots ||
+                               options->Length > 0 || options->Bench.Enabled || options->Generate)) {
+        printf("--cores only works with the summary output of a single cache level\n");
+        return -1;
+    }
+    //the TLBs follow the trace in order through one cache, and snapshots do not hold them
+    if (options->Tlb.Enabled && (options->Sweep || options->BatchFile[0] || options->NumLowerLevels > 0 ||
+                                 options->Cores > 0 || snapshots || options->Bench.Enabled || options->Generate)) {
+        printf("--tlb only works on a single cache without snapshots\n");
+        return -1;
+    }
+    //--best and --classify only know about the references of the trace, not the injected page table reads
+    if (options->Tlb.Inject && (options->BestHitRate || options->Classify)) {
+        printf("--tlb-inject cannot be combined with --best or --classify\n");
+        return -1;
+    }
+    if (options->Cores > 0 && userinput->WritePolicy[0] != 'B') {
+        printf("--cores needs write-back caches (-w B)\n");
+        return -1;
+    }
+    if (options->PrefetchDegree == 0) {
+        options->PrefetchDegree = DEFAULT_PREFETCH_DEGREE;
+    }
+    if (options->PrefetchDistance == 0) {
+        options->PrefetchDistance = DEFAULT_PREFETCH_DISTANCE;
+    }
+    //every level of a hierarchy is checked the same way, and blocks may only grow going down
+    Memory *above = userinput;
+    for (int i = 0; i < options->NumLowerLevels; i++) {
+        Memory *level = &options->Levels[i];
+        if (level->CacheSize == 0) {
+            printf("--l3 needs --l2\n");
+            return -1;
+        }
+        if (!FindReplacementPolicy(level->ReplacementPolicy[0]) || level->CacheBlockSize <= 0 ||
+            level->SetAssoc <= 0 || level->SetAssoc > 65535 ||
+            level->CacheSize < level->CacheBlockSize * level->SetAssoc ||
+            level->CacheBlockSize < above->CacheBlockSize ||
+            (options->Inclusion == INCLUSION_EXCLUSIVE && level->CacheBlockSize != above->CacheBlockSize)) {
+            printf("invalid L%d cache\n", i + 2);
+            return -1;
+        }
+        above = level;
+    }
+    return 0;
+}
+
+#ifndef CACHESIM_LIBRARY
+int main (int argc, char *argv[]) {
+
+char filename[256];
+if (argc > 1 && strcmp(argv[1], "--convert") == 0) {//convert a text file to the binary format
+    if (argc != 4) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    return ConvertTraceFile(argv[2], argv[3]) == 0 ? 0 : 1;
+}
+if (argc > 1) {//parameters given on the command line, run once without prompting
+    Memory *userinput = (Memory*)malloc(sizeof(Memory));
+    RunOptions options = {OUTPUT_SUMMARY, 1000, "", "", 0, 0, "", 0};
+    if (ParseCommandLine(argc, argv, userinput, filename, &options) != 0) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    if (options.SelfTest) {
+        free(userinput);
+        return RunSelfTest() == 0 ? 0 : 1;
+    }
+    if (options.Bench.Enabled) {
+        int status = RunBenchmark(userinput, &options);
+        free(userinput);
+        return status == 0 ? 0 : 1;
+    }
+    if (options.Generate) {
+        int status = GenerateTraceFile(&options.Generator, filename);
+        free(userinput);
+        return status == 0 ? 0 : 1;
+    }
+    if (options.BatchFile[0]) {
+        int threads = options.Threads > 0 ? options.Threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        int status = RunBatch(options.BatchFile, filename, userinput, threads > 0 ? threads : 1, &options);
+        free(userinput);
+        return status == 0 ? 0 : 1;
+    }
+    Size *BytesAndBits = CalculateSize(userinput);
+    if (!options.Sweep) {
+        PrintBytesAndBits(BytesAndBits);
+    }
+    int status = ReadFile(filename, userinput, BytesAndBits, &options);
+    free(BytesAndBits);
+    free(userinput);
+    return status == 0 ? 0 : 1;
+}
 char ch = 'y';
 do {//while user continues to enter y
-char filename[20];
+RunOptions options = {OUTPUT_FULL, 1, "", "", 1, 0, "", 0};
 Memory *userinput = GetUserData(filename);
 Size *BytesAndBits = CalculateSize(userinput);
 PrintBytesAndBits(BytesAndBits);
-FileContents *fileContents = ReadFile(filename,userinput, BytesAndBits);
+ReadFile(filename, userinput, BytesAndBits, &options);
+free(BytesAndBits);
+free(userinput);
 printf("\nContinue? (y = yes, n = no): ");
 scanf(" %c", &ch);
 }while (ch=='y');
     return 0;
 }
-
+#endif